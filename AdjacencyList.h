@@ -1,158 +1,234 @@
-#include <iterator>
+#include <algorithm>
 #include <list>
+#include <vector>
 
-#include <boost/unordered_map.hpp>
-#include <boost/shared_ptr.hpp>
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/topological_sort.hpp>
+#include <boost/atomic.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
 
 #ifndef AdjacencyList_h
 #define AdjacencyList_h
 
+/* The number of independently locked shards of the vertex index, and the number of edges stored in each block of an
+ * adjacency list.  Vertices are stored in chunks, the first of which holds 2^GRAPH_FIRST_CHUNK_BITS vertices, and each
+ * of which is twice the size of the last.
+ */
+#define GRAPH_VERTEX_SHARDS 64
+#define GRAPH_EDGE_BLOCK_SIZE 8
+#define GRAPH_FIRST_CHUNK_BITS 10
+#define GRAPH_MAX_CHUNKS 48
+
 /**
- * Convenience wrapper for a thread-safe directed unweighted graph with vertices labeled with a specific type.
+ * A concurrent, append-only directed graph with vertices labeled with a specific type.  Vertices and edges may be added
+ * from any number of threads at once, and are never removed.
+ *
+ * Each vertex is interned once, under the lock of one of GRAPH_VERTEX_SHARDS shards of the vertex index, so threads
+ * adding different vertices rarely wait on each other.  The vertices themselves are stored in chunks that are never
+ * moved, and each adjacency list is a stack of fixed-size blocks of edges; a slot in a block is claimed with a single
+ * atomic increment, and a new block is pushed with a single compare-and-swap.  Duplicate edges are not detected, and are
+ * simply stored twice.
+ *
+ * Reading the edges (containsEdge(), successors()) requires that no edges are being added at the same time.
  *
  * @param <T> The vertex type.  Must be default-constructible, copy-constructible, assignable, and hashable.
  */
 template <class T>
-class Graph {
-	typedef boost::adjacency_list<boost::vecS, boost::vecS, boost::directedS, T> internalGraph;
-	
-	typedef typename boost::graph_traits<internalGraph>::vertex_descriptor VertexDescriptor;
-	typedef typename boost::graph_traits<internalGraph>::edge_descriptor EdgeDescriptor;
-	
-	typedef typename boost::graph_traits<internalGraph>::vertex_iterator VertexIterator;
-	typedef typename boost::graph_traits<internalGraph>::edge_iterator EdgeIterator;
-	
-	typedef boost::shared_ptr<boost::shared_mutex> mutex_ptr;
-	typedef boost::shared_lock<boost::shared_mutex> ReadLock;
-	typedef boost::upgrade_lock<boost::shared_mutex> RereadLock;
-	typedef boost::upgrade_to_unique_lock<boost::shared_mutex> WriteLock;
+class Graph : public boost::noncopyable {
+	struct EdgeBlock {
+		boost::atomic<std::size_t> count;		// Slots claimed so far, which may overshoot GRAPH_EDGE_BLOCK_SIZE
+		std::size_t targets[GRAPH_EDGE_BLOCK_SIZE];
+		EdgeBlock* next;
+		
+		explicit EdgeBlock(EdgeBlock* next_) : count(0), next(next_) {}
+		
+		std::size_t size() const { return std::min<std::size_t>(count.load(boost::memory_order_relaxed), GRAPH_EDGE_BLOCK_SIZE); }
+	};
 	
-	struct Transformer {
-		const internalGraph& G;
-		Transformer(const internalGraph& G_) : G(G_) {}
+	struct Vertex {
+		T value;
+		boost::atomic<EdgeBlock*> edges;
+		boost::atomic<std::size_t> inDegree;
 		
-		T operator()(const VertexDescriptor& v) { return G[v]; }
+		Vertex() : value(), edges(static_cast<EdgeBlock*>(NULL)), inDegree(0) {}
+	};
+	
+	struct Shard {
+		boost::mutex mutex;
+		boost::unordered_map<T, std::size_t> index;
 	};
 public:
-	typedef typename boost::graph_traits<internalGraph>::vertices_size_type VertexSizeType;
-	typedef typename boost::graph_traits<internalGraph>::edges_size_type EdgeSizeType;
+	typedef std::size_t VertexSizeType;
+	typedef std::size_t EdgeSizeType;
 	
-	Graph() : G() {}
+	Graph() : nextVertex(0), edgeCount(0) {
+		for (std::size_t i = 0; i < GRAPH_MAX_CHUNKS; i++) chunks[i].store(NULL, boost::memory_order_relaxed);
+	}
+	
+	~Graph() {
+		std::size_t n = numVertices();
+		for (std::size_t i = 0; i < n; i++) {
+			EdgeBlock* block = vertexAt(i).edges.load(boost::memory_order_relaxed);
+			while (block) {
+				EdgeBlock* next = block->next;
+				delete block;
+				block = next;
+			}
+		}
+		for (std::size_t i = 0; i < GRAPH_MAX_CHUNKS; i++) delete[] chunks[i].load(boost::memory_order_relaxed);
+	}
+	
+	/**
+	 * Adds a vertex to the graph, and returns its index.  Does nothing but return the index if the vertex already exists.
+	 */
+	std::size_t addVertex(const T& vertex) {
+		bool added;
+		return addVertex(vertex, added);
+	}
 	
 	/**
-	 * Adds a vertex to the graph.  Does nothing if the vertex already exists.
+	 * Adds a vertex to the graph, and returns its index.  added is set to whether the vertex is new, so that of all the
+	 * threads adding the same vertex, exactly one sees it added.
 	 */
-	void addVertex(const T& vertex) {
-		if (containsVertex(vertex)) return;
+	std::size_t addVertex(const T& vertex, bool& added) {
+		Shard& shard = shardOf(vertex);
+		boost::mutex::scoped_lock lock(shard.mutex);
 		
-		RereadLock rereadLock(mutex);				// Reread Lock
-		if (descriptorMap.count(vertex) == 0) {		// Check again to see if vertex was inserted while waiting
-			WriteLock writeLock(rereadLock);		// Write Lock
-			
-			// Add the vertex
-			VertexDescriptor vd = boost::add_vertex(vertex, G);
-			descriptorMap[vertex] = vd;
-			
-			// Create the new vertex mutex
-			vertexMutexes.insert(std::pair<T, mutex_ptr>(vertex, mutex_ptr(new boost::shared_mutex())));
-		}
+		typename boost::unordered_map<T, std::size_t>::const_iterator it = shard.index.find(vertex);
+		added = (it == shard.index.end());
+		if (!added) return it->second;
+		
+		std::size_t index = nextVertex.fetch_add(1, boost::memory_order_relaxed);
+		vertexAt(index).value = vertex;
+		shard.index.insert(std::make_pair(vertex, index));
+		return index;
 	}
 	
 	/**
 	 * Determines if the vertex is present in the graph.
 	 */
 	bool containsVertex(const T& vertex) const {
-		ReadLock readLock(mutex);					// Read Lock
-		return descriptorMap.count(vertex) != 0;
+		Shard& shard = shardOf(vertex);
+		boost::mutex::scoped_lock lock(shard.mutex);
+		return shard.index.count(vertex) != 0;
 	}
 	
 	/**
 	 * Adds an edge to the graph.  Creates the vertices if they do not exist.
 	 */
 	void addEdge(const T& from, const T& to) {
-		if (!containsVertex(from)) addVertex(from);
-		if (!containsVertex(to)) addVertex(to);
-		
-		// Lock only the from vertex
-		boost::shared_mutex& fromMutex = *(vertexMutexes[from]);
-		RereadLock rereadLock(fromMutex);				// Reread Lock
-		
-		// TODO - move the following two into the read lock section?
-		VertexDescriptor from_d = getDescriptor(from);
-		VertexDescriptor to_d = getDescriptor(to);
-		
-		if (!boost::edge(from_d, to_d, G).second) {		// If the vertex wasn't created while waiting
-			WriteLock writeLock(rereadLock);			// Write Lock
+		addEdgeBetween(addVertex(from), addVertex(to));
+	}
+	
+	/**
+	 * Adds an edge between the vertices with the given indices (as returned by addVertex()).
+	 */
+	void addEdgeBetween(std::size_t from_i, std::size_t to_i) {
+		boost::atomic<EdgeBlock*>& edges = vertexAt(from_i).edges;
+		EdgeBlock* block = edges.load(boost::memory_order_acquire);
+		while (true) {
+			if (block) {
+				std::size_t slot = block->count.fetch_add(1, boost::memory_order_relaxed);
+				if (slot < GRAPH_EDGE_BLOCK_SIZE) {
+					block->targets[slot] = to_i;
+					break;
+				}
+			}
 			
-			boost::add_edge(from_d, to_d, G);
+			// The block is full (or there is none yet), so push a new one holding the edge
+			EdgeBlock* newBlock = new EdgeBlock(block);
+			newBlock->targets[0] = to_i;
+			newBlock->count.store(1, boost::memory_order_relaxed);
+			if (edges.compare_exchange_weak(block, newBlock, boost::memory_order_release, boost::memory_order_acquire)) break;
+			delete newBlock;						// Someone else pushed a block first; block is now theirs, so try again
 		}
+		
+		vertexAt(to_i).inDegree.fetch_add(1, boost::memory_order_relaxed);
+		edgeCount.fetch_add(1, boost::memory_order_relaxed);
 	}
 	
 	bool containsEdge(const T& from, const T& to) const {
-		if (!containsVertex(from)) return false;
-		if (!containsVertex(to)) return false;
-		
-		ReadLock readLock(mutex);					// Previous checks had read locks, so now we have to have their own.
-		VertexDescriptor from_d = getDescriptor(from);
-		VertexDescriptor to_d = getDescriptor(to);
+		if (!containsVertex(from) || !containsVertex(to)) return false;
 		
-		return boost::edge(from_d, to_d, G).second;
+		std::size_t to_i = indexOf(to);
+		for (const EdgeBlock* block = vertexAt(indexOf(from)).edges.load(boost::memory_order_acquire); block; block = block->next) {
+			if (std::find(block->targets, block->targets + block->size(), to_i) != block->targets + block->size()) return true;
+		}
+		return false;
 	}
 	
-	VertexSizeType numVertices() const {
-		ReadLock readLock(mutex);						// Read Lock
-		return boost::num_vertices(G);
-	}
-	EdgeSizeType numEdges() const {
-		ReadLock readLock(mutex);						// Read Lock
-		return boost::num_edges(G);
-	}
+	/**
+	 * Returns the vertex with the given index.  Vertices are numbered from 0 in the order they were added.
+	 */
+	const T& vertex(std::size_t index) const { return vertexAt(index).value; }
 	
-	std::list<T> getVertices() const {
-		ReadLock readLock(mutex);						// Read Lock
-		std::pair<VertexIterator, VertexIterator> its = vertices();
-		
-		std::list<T> result;
-		std::transform(its.first(), its.second(), std::back_inserter(result), Transformer(G));
+	/**
+	 * Returns the number of edges into the vertex with the given index.
+	 */
+	std::size_t inDegree(std::size_t index) const { return vertexAt(index).inDegree.load(boost::memory_order_acquire); }
+	
+	/**
+	 * Returns the indices of the vertices that the edges out of the vertex with the given index go to.
+	 */
+	std::vector<std::size_t> successors(std::size_t index) const {
+		std::vector<std::size_t> result;
+		for (const EdgeBlock* block = vertexAt(index).edges.load(boost::memory_order_acquire); block; block = block->next) {
+			result.insert(result.end(), block->targets, block->targets + block->size());
+		}
 		return result;
 	}
 	
-	std::list<T> topological_sort() const {
-		ReadLock readLock(mutex);						// Read Lock
-		std::deque<VertexDescriptor> descriptors;
-		boost::topological_sort(G, std::front_inserter(descriptors));
-		
+	VertexSizeType numVertices() const { return nextVertex.load(boost::memory_order_acquire); }
+	EdgeSizeType numEdges() const { return edgeCount.load(boost::memory_order_acquire); }
+	
+	std::list<T> getVertices() const {
 		std::list<T> result;
-		std::transform(descriptors.begin(), descriptors.end(), std::back_inserter(result), Transformer(G));
-		
+		std::size_t n = numVertices();
+		for (std::size_t i = 0; i < n; i++) result.push_back(vertexAt(i).value);
 		return result;
 	}
-private:
-	internalGraph G;
-	// BGL does not track the T-VertexDescriptor association, so we do so manually.
-	boost::unordered_map<T, VertexDescriptor> descriptorMap;
 	
-	mutable boost::shared_mutex mutex;					// mutable so that a const Graph can get locks!
-	boost::unordered_map<T, mutex_ptr> vertexMutexes;	// boost::shared_mutex is not copyable, so heap allocate
+private:
+	mutable boost::atomic<Vertex*> chunks[GRAPH_MAX_CHUNKS];	// Allocated on first use
+	mutable Shard shards[GRAPH_VERTEX_SHARDS];					// mutable so that a const Graph can get locks!
+	boost::atomic<std::size_t> nextVertex;
+	boost::atomic<std::size_t> edgeCount;
 	
-	std::pair<VertexIterator, VertexIterator> vertices() const { return boost::vertices(G); }
-	std::pair<EdgeIterator, EdgeIterator> edges() const { return boost::edges(G); }
+	Shard& shardOf(const T& vertex) const { return shards[boost::hash<T>()(vertex) % GRAPH_VERTEX_SHARDS]; }
 	
 	/**
-	 * Returns the vertex descriptor for a vertex.
+	 * Returns the index of a vertex.
 	 *
 	 * Precondition: the vertex must already be in the graph.
 	 */
-	VertexDescriptor getDescriptor(const T& vertex) { return descriptorMap[vertex]; }
-	
-	template <class PropertyTag>
-	typename boost::property_map<internalGraph, PropertyTag>::type get(PropertyTag tag) { return boost::get(tag, G); }
+	std::size_t indexOf(const T& vertex) const {
+		Shard& shard = shardOf(vertex);
+		boost::mutex::scoped_lock lock(shard.mutex);
+		return shard.index.find(vertex)->second;
+	}
 	
-	template <class PropertyTag>
-	typename boost::property_map<internalGraph, PropertyTag>::const_type get(PropertyTag tag) const { return boost::get(tag, G); }
+	/**
+	 * Returns the vertex with the given index, allocating the chunk that holds it if need be.
+	 */
+	Vertex& vertexAt(std::size_t index) const {
+		// Chunk c holds the indices from (2^c - 1) * 2^GRAPH_FIRST_CHUNK_BITS up to twice that
+		std::size_t scaled = (index >> GRAPH_FIRST_CHUNK_BITS) + 1;
+		unsigned int c = 0;
+		while (scaled >>= 1) c++;
+		std::size_t chunkStart = ((std::size_t(1) << c) - 1) << GRAPH_FIRST_CHUNK_BITS;
+		
+		Vertex* chunk = chunks[c].load(boost::memory_order_acquire);
+		if (!chunk) {
+			Vertex* newChunk = new Vertex[std::size_t(1) << (c + GRAPH_FIRST_CHUNK_BITS)];
+			if (chunks[c].compare_exchange_strong(chunk, newChunk, boost::memory_order_acq_rel, boost::memory_order_acquire)) {
+				chunk = newChunk;
+			} else {
+				delete[] newChunk;					// Someone else allocated it first
+			}
+		}
+		return chunk[index - chunkStart];
+	}
 };
 
 #endif
@@ -1,14 +1,17 @@
+#include <algorithm>
+#include <map>
+
+#include <boost/bind.hpp>
+#include <boost/dynamic_bitset.hpp>
 #include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/iterator/transform_iterator.hpp>
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_int.hpp>
-#include <boost/random/variate_generator.hpp>
+#include <permlib/search/orbit_lex_min_search.h>
 
 #include "AnchorSet.h"
+#include "CacheRegistry.h"
 #include "LookupTable.h"
-
-boost::mt19937 rng;
+#include "PackedSubsetTable.h"
 
 /* *********************************************************************************************** */
 /**
@@ -19,15 +22,31 @@ boost::mt19937 rng;
  */
 class AnchorSetEvaluator {
 	const boost::unordered_map<Permutation, Subset> imageSet;
+	const std::vector<PackedSubset> packedImages;
+	const std::vector<unsigned long> imageCounts;
 public:
 	typedef std::vector<unsigned long> FrequencyVector;
 	
-	explicit AnchorSetEvaluator(const boost::unordered_map<Permutation, Subset>& _imageSet)
-		: imageSet(_imageSet) {}
+	/**
+	 * If there are packed images, the image set is not needed, and is not copied.
+	 */
+	AnchorSetEvaluator(const boost::unordered_map<Permutation, Subset>& _imageSet, const std::vector<PackedSubset>& _packedImages, const std::vector<unsigned long>& _imageCounts)
+		: imageSet(_packedImages.empty() ? _imageSet : boost::unordered_map<Permutation, Subset>()), packedImages(_packedImages), imageCounts(_imageCounts) {}
+	
+	bool isPacked() const { return !packedImages.empty(); }
+	
+	FrequencyVector operator()(PackedSubset B) const {
+		FrequencyVector v(popcount(B) + 1);
+		for (std::size_t i = 0; i < packedImages.size(); i++) {
+			v[popcount(packedImages[i] & B)] += imageCounts[i];
+		}
+		return v;
+	}
 	
 	FrequencyVector operator()(const Subset& B) const {
-		FrequencyVector v(B.size() + 1);
+		if (isPacked()) return (*this)(packSubset(B));
 		
+		FrequencyVector v(B.size() + 1);
 		typedef boost::function<Subset (boost::unordered_map<Permutation, Subset>::value_type)> Function;
 		typedef boost::unordered_map<Permutation, Subset>::const_iterator BaseIterator;
 		typedef boost::transform_iterator<Function, BaseIterator> Iterator;
@@ -43,14 +62,26 @@ public:
 		}
 		return v;
 	}
+	
+	std::size_t memoryUsage() const {
+		std::size_t bytes = imageSet.bucket_count() * sizeof(void*);
+		for (boost::unordered_map<Permutation, Subset>::const_iterator it = imageSet.begin(); it != imageSet.end(); ++it) {
+			bytes += CONTAINER_NODE_OVERHEAD + sizeof(boost::unordered_map<Permutation, Subset>::value_type);
+			bytes += it->first.size() * sizeof(permlib::dom_int) + approximateMemoryUsage(it->second);
+		}
+		return bytes + approximateMemoryUsage(packedImages) + approximateMemoryUsage(imageCounts);
+	}
 };
 
+std::size_t approximateMemoryUsage(const AnchorSetEvaluator& eval) { return eval.memoryUsage(); }
+
 /* *********************************************************************************************** */
 /**
- * Table that caches the results of previous AnchorSet evaluation calls.
+ * Table that caches the results of previous AnchorSet evaluation calls.  Each size of subsets has its own table, which is
+ * keyed by packed subsets if the images are packed.
  */
-class AnchorSetLookupTable : public SizeIndependentLookupTable<AnchorSetEvaluator> {
-	typedef SizeIndependentLookupTable<AnchorSetEvaluator> super_type;
+class AnchorSetLookupTable : public SizeIndependentLookupTable<AnchorSetEvaluator, SubsetLookupTable<AnchorSetEvaluator> > {
+	typedef SizeIndependentLookupTable<AnchorSetEvaluator, SubsetLookupTable<AnchorSetEvaluator> > super_type;
 public:
 	typedef super_type::mapped_type Subtable;
 	
@@ -59,28 +90,86 @@ public:
 
 /* *********************************************************************************************** */
 /**
- * Evaluation cache for AnchorSet::evaluate().  This is implemented as a "classic singleton", which
- * is thread-safe only in C++11.  It should be thread-safe under C++03 on gcc and clang, the
- * two compilers used in development.
+ * Bound AnchorSet over packed images.  Batches are evaluated a block of MATRIXGENERATOR_ANCHORSET_BATCH_BLOCK subsets at a time: the
+ * subsets in the block that already have results are read from the lookup table, and the frequency vectors of the rest
+ * are tallied together, in a single sweep over the images of the anchor set.
  */
-class AnchorSetEvalCache : public boost::noncopyable, public HeapValueStdMapCache<AnchorSet, AnchorSetLookupTable, HeapValueFromKeyInsertDelegate<AnchorSetLookupTable>, AnchorSetWeakOrdering>::type {
-	// boost::noncopyable also implicitly deletes move constructor
+class AnchorSetBinding : public LookupTableBinding<AnchorSetLookupTable::Subtable> {
+	typedef AnchorSetLookupTable::Subtable Subtable;
+	
+	const std::vector<PackedSubset>* packedImages;
+	const std::vector<unsigned long>* imageCounts;
+public:
+	AnchorSetBinding(Subtable& table_, const std::vector<PackedSubset>& packedImages_, const std::vector<unsigned long>& imageCounts_) :
+		LookupTableBinding<Subtable>(table_), packedImages(&packedImages_), imageCounts(&imageCounts_) {}
 	
+	void evaluateBatch(const PackedSubset* subsets, std::size_t n, unsigned long* results) const {
+		for (std::size_t first = 0; first < n; first += MATRIXGENERATOR_ANCHORSET_BATCH_BLOCK) {
+			evaluateBlock(subsets + first, std::min<std::size_t>(MATRIXGENERATOR_ANCHORSET_BATCH_BLOCK, n - first), results + first);
+		}
+	}
+private:
+	void evaluateBlock(const PackedSubset* subsets, std::size_t n, unsigned long* results) const {
+		PackedSubset missing[MATRIXGENERATOR_ANCHORSET_BATCH_BLOCK];
+		std::size_t missingIdx[MATRIXGENERATOR_ANCHORSET_BATCH_BLOCK];
+		std::size_t numMissing = 0;
+		for (std::size_t i = 0; i < n; i++) {
+			const unsigned long* cached = table->find(subsets[i]);
+			if (cached) {
+				results[i] = *cached;
+			} else {
+				missing[numMissing] = subsets[i];
+				missingIdx[numMissing++] = i;
+			}
+		}
+		if (numMissing == 0) return;
+		
+		// Every subset in the batch has the same size, so every frequency vector has the same length
+		std::size_t length = popcount(missing[0]) + 1;
+		unsigned long tallies[MATRIXGENERATOR_ANCHORSET_BATCH_BLOCK][MAX_PACKED_POINTS + 1] = {};
+		const PackedSubset* images = &(*packedImages)[0];
+		const unsigned long* counts = &(*imageCounts)[0];
+		for (std::size_t i = 0; i < packedImages->size(); i++) {
+			PackedSubset image = images[i];
+			unsigned long count = counts[i];
+			for (std::size_t j = 0; j < numMissing; j++) {
+				tallies[j][popcount(image & missing[j])] += count;
+			}
+		}
+		
+		// Translate under the write lock of the lookup table, as if the subsets had been queried one at a time
+		Subtable::translator_type& translator = table->getTranslator();
+		for (std::size_t j = 0; j < numMissing; j++) {
+			AnchorSetEvaluator::FrequencyVector fv(tallies[j], tallies[j] + length);
+			PrecomputedTranslation<Subtable::translator_type> translate(translator, fv);
+			results[missingIdx[j]] = table->query(missing[j], translate);
+		}
+	}
+};
+
+/* *********************************************************************************************** */
+/**
+ * Evaluation cache for AnchorSet::evaluate().  It is keyed by ID, as a copy of an AnchorSet holds all of its images.
+ * This is implemented as a "classic singleton", which is thread-safe only in C++11.  It should be thread-safe under C++03
+ * on gcc and clang, the two compilers used in development.
+ */
+class AnchorSetEvalCache : public boost::noncopyable, public IdKeyedCache<AnchorSet, AnchorSetLookupTable> {
+	// boost::noncopyable also implicitly deletes move constructor
+
 public:
 	static AnchorSetEvalCache& getInstance() {
 		static AnchorSetEvalCache instance;
 		return instance;
 	}
 private:
-	AnchorSetEvalCache() {}
+	AnchorSetEvalCache() { CacheRegistry::getInstance().add("AnchorSetEvalCache", *this); }
 };
 
 /* *********************************************************************************************** */
 // AnchorSetWeakOrdering methods
 
 bool AnchorSetWeakOrdering::operator()(const AnchorSet& lhs, const AnchorSet& rhs) const {
-	if (GroupWeakOrdering()(lhs.getGroup(), rhs.getGroup())) return true;
-	return lhs.getAnchorSet() < rhs.getAnchorSet();
+	return lhs.getId() < rhs.getId();
 }
 
 /* *********************************************************************************************** */
@@ -98,58 +187,128 @@ bool AnchorSetWeakOrdering::operator()(const AnchorSet& lhs, const AnchorSet& rh
  * @param G The permutation group the set is to be operate over.
  * @param v The largest element in the set X = {1, .., v}
  * @param size The size of the anchor set.
+ * @param rng The source of the anchor set's points.  Building from a generator with the same key gives the same set.
+ */
+AnchorSet::ptr AnchorSet::buildAnchorSet(const Group& G, size_t size, SplitMix64& rng) {
+	return buildAnchorSet(G, drawAnchorSet(G, size, rng));
+}
+
+/**
+ * Creates the anchor set of the given points.  Anchor sets in the same orbit of G (see canonicalForm()) are the same
+ * G-invariant function, so only one of them is of any use.
  */
-AnchorSet::ptr AnchorSet::buildAnchorSet(const Group& G, size_t size) {
+AnchorSet::ptr AnchorSet::buildAnchorSet(const Group& G, const Subset& anchorSet) {
+	return AnchorSet::ptr(new AnchorSet(G, anchorSet));
+}
+
+/**
+ * Draws the points of a random anchor set of the given size.
+ */
+Subset AnchorSet::drawAnchorSet(const Group& G, size_t size, SplitMix64& rng) {
 	Subset anchorSet;
 	
-	// Initialize random number generator
 	// Permutation uses {0, .., v - 1} to represent X = {1, .., v}
-	boost::uniform_int<long> distribution(0, G.getNumPoints() - 1);
-	boost::variate_generator<boost::mt19937&, boost::uniform_int<long> > rand(rng, distribution);
-	
-	// Populate anchor set
 	while (anchorSet.size() < size) {
-		long candidate = rand();
-		if (anchorSet.count(candidate) == 0) anchorSet.insert(candidate);
+		anchorSet.insert(rng.below(G.getNumPoints()));
 	}
-	
-	return AnchorSet::ptr(new AnchorSet(G, anchorSet));
+	return anchorSet;
 }
 
-AnchorSet::AnchorSet(const Group& _G, const Subset& _anchorSet) :
-	GInvariant(_G), anchorSet(_anchorSet), imageSet() {
-	// Build the image set
-	for (GroupElementIterator it = G->elementsBegin(); it != G->elementsEnd(); it++) {
-		Permutation g = *it;
-		
-		// apply g to anchorSet
-		Subset image;
-		std::transform(anchorSet.begin(), anchorSet.end(), std::inserter(image, image.begin()), boost::bind(&Permutation::at, g, _1));
-		
-		imageSet[g] = image;
+/**
+ * Returns the lexicographically least image of anchorSet under G.  Two anchor sets give the same function if and only
+ * if they have the same canonical form.
+ */
+Subset AnchorSet::canonicalForm(const Group& G, const Subset& anchorSet) {
+	typedef boost::dynamic_bitset<unsigned long> dset;
+	
+	dset anchorBitset(G.getNumPoints());
+	for (Subset::const_iterator it = anchorSet.begin(); it != anchorSet.end(); ++it) {
+		anchorBitset[*it] = true;
 	}
+	
+	permlib::OrbitLexMinSearch<PermutationGroup> search(G.getGroup());
+	dset resultBitset = search.lexMin(anchorBitset);
+	
+	Subset result;
+	for (dset::size_type i = resultBitset.find_first(); i != dset::npos; i = resultBitset.find_next(i)) {
+		result.insert(result.end(), i);
+	}
+	return result;
 }
 
 /**
- * Compares two AnchorSets for equality.
- * 
- * Two AnchorSets over the same group are equal if their sets are equal.
+ * Returns the length of the G-orbit of anchorSet, which is the number of distinct images that its function evaluates
+ * over.  The longer the orbit (the smaller the stabilizer), the more images there are to tell subsets apart by.  The
+ * orbit is walked with the strong generators of G, without building the anchor set, and the walk stops as soon as the
+ * orbit is as long as |G|.
+ *
+ * Precondition: G.getNumPoints() <= MAX_PACKED_POINTS
  */
-bool AnchorSet::equals(const GInvariant& rhs) const {
-	if (!GInvariant::equals(rhs)) return false;
-	const AnchorSet& other = static_cast<const AnchorSet&>(rhs);
-	return anchorSet == other.anchorSet;
+boost::uint64_t AnchorSet::orbitLength(const Group& G, const Subset& anchorSet) {
+	const PermutationGroup::PERMlist& generators = G.getGroup().S;
+	
+	PackedSubset start = packSubset(anchorSet);
+	if (start == 0) return 1;		// The empty set cannot be a key of a PackedSubsetTable
+	
+	PackedSubsetTable orbit;
+	std::vector<PackedSubset> frontier(1, start);
+	orbit.insert(start, 0);
+	while (!frontier.empty() && orbit.size() < G.order()) {
+		PackedSubset B = frontier.back();
+		frontier.pop_back();
+		for (PermutationGroup::PERMlist::const_iterator it = generators.begin(); it != generators.end(); ++it) {
+			PackedSubset image = applyPermutation(**it, B);
+			if (!orbit.contains(image)) {
+				orbit.insert(image, 0);
+				frontier.push_back(image);
+			}
+		}
+	}
+	return orbit.size();
 }
 
-std::size_t AnchorSet::hash() const {
-	std::size_t seed = 0;
-	boost::hash_combine(seed, getGroup());
-	boost::hash_combine(seed, getAnchorSet());
-	return seed;
+AnchorSet::AnchorSet(const Group& _G, const Subset& _anchorSet) :
+	GInvariant(_G), anchorSet(_anchorSet), imageSet(), packedImages(), imageCounts() {
+	if (G->getNumPoints() <= MAX_PACKED_POINTS) {
+		// Only the distinct images are evaluated over, so they are counted straight away, and the image set is not built
+		PackedSubset packedAnchorSet = packSubset(anchorSet);
+		PackedSubsetTable imageIdx;
+		for (GroupElementIterator it = G->elementsBegin(); it != G->elementsEnd() && packedAnchorSet != 0; it++) {
+			PackedSubset image = applyPermutation(*it, packedAnchorSet);
+			
+			const unsigned long* idx = imageIdx.find(image);
+			if (idx) {
+				imageCounts[*idx]++;
+			} else {
+				imageIdx.insert(image, packedImages.size());
+				packedImages.push_back(image);
+				imageCounts.push_back(1);
+			}
+		}
+		if (packedAnchorSet == 0) {
+			// The empty anchor set is its own only image (and cannot be a key of a PackedSubsetTable)
+			packedImages.push_back(0);
+			imageCounts.push_back(G->order());
+		}
+	} else {
+		// Build the image set
+		for (GroupElementIterator it = G->elementsBegin(); it != G->elementsEnd(); it++) {
+			Permutation g = *it;
+			
+			// apply g to anchorSet
+			Subset image;
+			std::transform(anchorSet.begin(), anchorSet.end(), std::inserter(image, image.begin()), boost::bind(&Permutation::at, g, _1));
+			
+			imageSet[g] = image;
+		}
+	}
+	
+	// Two AnchorSets over the same group are equal if their sets are equal
+	intern(std::vector<boost::uint64_t>(anchorSet.begin(), anchorSet.end()));
 }
 
 AnchorSet::Evaluator AnchorSet::createEvaluator() const {
-	return Evaluator(imageSet);
+	return Evaluator(imageSet, packedImages, imageCounts);
 }
 
 /**
@@ -167,9 +326,39 @@ unsigned long AnchorSet::evaluate(const Subset& B) const {
 	return table.query(B);
 }
 
+BoundGInvariant::ptr AnchorSet::bind(Subset::size_type size) const {
+	AnchorSetLookupTable& cache = AnchorSetEvalCache::getInstance().query(*this);
+	if (packedImages.empty()) return bindLookupTable(cache, size);
+	return BoundGInvariant::ptr(new AnchorSetBinding(cache.query(size), packedImages, imageCounts));
+}
+
 bool AnchorSet::hasCachedResult(const Subset& B) const {
 	AnchorSetLookupTable& cache = AnchorSetEvalCache::getInstance().query(*this);
 	AnchorSetLookupTable::Subtable& table = cache.query(B.size());
 	return table.contains(B);
 }
 
+std::size_t AnchorSet::cacheMemoryUsage() const {
+	AnchorSetEvalCache& evalCache = AnchorSetEvalCache::getInstance();
+	if (!evalCache.contains(*this)) return 0;
+	
+	// This includes the copy of the images held by the lookup table and each of its subtables
+	return evalCache.query(*this).memoryUsage();
+}
+
+void AnchorSet::dropCachedResults() const {
+	AnchorSetEvalCache::getInstance().erase(*this);
+}
+
+boost::function<void ()> AnchorSet::cacheDropper() const {
+	return boost::bind(&AnchorSetEvalCache::eraseId, &AnchorSetEvalCache::getInstance(), getId());
+}
+
+void AnchorSet::retireCachedResults(Subset::size_type size) const {
+	AnchorSetEvalCache& evalCache = AnchorSetEvalCache::getInstance();
+	if (!evalCache.contains(*this)) return;
+	AnchorSetLookupTable& cache = evalCache.query(*this);
+	for (Subset::size_type s = 0; s < size; s++) {
+		cache.erase(s);
+	}
+}
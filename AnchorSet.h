@@ -1,4 +1,5 @@
 #include <map>
+#include <vector>
 
 #include <boost/unordered_map.hpp>
 #include <boost/type_traits/integral_constant.hpp>
@@ -8,6 +9,13 @@
 
 #include "GInvariant.h"
 
+/* The number of subsets that a bound AnchorSet evaluates together, in a single sweep over the images of its anchor set
+ * (see BoundGInvariant::evaluateBatch()).
+ */
+#ifndef MATRIXGENERATOR_ANCHORSET_BATCH_BLOCK
+#define MATRIXGENERATOR_ANCHORSET_BATCH_BLOCK 8
+#endif
+
 class AnchorSetEvaluator;
 
 /**
@@ -24,25 +32,44 @@ public:
 	
 	virtual ~AnchorSet() {}
 	
-	static ptr buildAnchorSet(const Group& G, size_t size);
+	static ptr buildAnchorSet(const Group& G, size_t size, SplitMix64& rng);
+	static ptr buildAnchorSet(const Group& G, const Subset& anchorSet);
+	
+	static Subset drawAnchorSet(const Group& G, size_t size, SplitMix64& rng);
+	static Subset canonicalForm(const Group& G, const Subset& anchorSet);
+	static boost::uint64_t orbitLength(const Group& G, const Subset& anchorSet);
 	
 	const Subset& getAnchorSet() const { return anchorSet; }
 	
+	/**
+	 * Returns the number of images that each evaluation sweeps over: the distinct images of the anchor set if they are
+	 * packed, and one image for each element of G otherwise.
+	 */
+	std::size_t numImages() const { return packedImages.empty() ? imageSet.size() : packedImages.size(); }
+	
 	bool operator==(const AnchorSet& rhs) const { return equals(rhs); }
 	bool operator!=(const AnchorSet& rhs) const { return !equals(rhs); }
-	bool equals(const GInvariant& rhs) const;
-	std::size_t hash() const;
 	Evaluator createEvaluator() const;
 	
 	unsigned long evaluate(const Subset& B) const;
+	BoundGInvariant::ptr bind(Subset::size_type size) const;
 	bool hasCachedResult(const Subset& B) const;
+	std::size_t cacheMemoryUsage() const;
+	void dropCachedResults() const;
+	boost::function<void ()> cacheDropper() const;
+	void retireCachedResults(Subset::size_type size) const;
 private:
 	AnchorSet(const Group& G, const Subset& anchorset);	// Must go through factory
 	
 	Subset anchorSet;							// The anchor set, for comparison purposes
 	// Permutation does not have operator<(), so we must use unordered maps for the image
-	// set.  Replace with std::unordered_map with C++0x.
+	// set.  Replace with std::unordered_map with C++0x.  This is only built if v > MAX_PACKED_POINTS.
 	boost::unordered_map<Permutation, Subset> imageSet;
+	
+	// The distinct images of the anchor set, packed, and the number of elements of G that give each one.  These are only
+	// built if v <= MAX_PACKED_POINTS, in which case they are evaluated over instead of the image set.
+	std::vector<PackedSubset> packedImages;
+	std::vector<unsigned long> imageCounts;
 };
 
 /**
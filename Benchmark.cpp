@@ -0,0 +1,253 @@
+#include <iostream>
+#include <vector>
+
+#include <boost/any.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/random/mersenne_twister.hpp>
+#include <boost/random/uniform_int.hpp>
+#include <boost/random/variate_generator.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "AnchorSet.h"
+#include "Benchmark.h"
+#include "Cache.h"
+#include "Discriminator.h"
+#include "Groups.h"
+#include "KMBuilder.h"
+#include "KMCompute.h"
+#include "LevelMetrics.h"
+#include "PrunerSelector.h"
+#include "TablePruner.h"
+#include "TaskQueue.h"
+
+// Configuration of the suite.  The seed is fixed so that every run evaluates the same subsets.
+#define BENCHMARK_SEED 20130601
+#define BENCHMARK_NUM_SUBSETS 50
+#define BENCHMARK_CACHE_KEYS 64
+#define BENCHMARK_CACHE_QUERIES 200000
+
+void Benchmark::report(const std::string& name, unsigned long iterations, const boost::timer::cpu_times& elapsed, double items) {
+	double seconds = elapsed.wall / 1e9;
+	out << "{\"benchmark\":\"" << name << "\",\"iterations\":" << iterations << ",\"seconds\":" << seconds;
+	out << ",\"nsPerIteration\":" << elapsed.wall / double(iterations);
+	out << ",\"itemsPerSecond\":" << (seconds > 0 ? items / seconds : 0) << "}" << std::endl;
+}
+
+/**
+ * Generates count random k-subsets of {0, ..., v - 1}.
+ */
+std::vector<Subset> randomSubsets(unsigned int v, unsigned int k, std::size_t count) {
+	boost::mt19937 rng(BENCHMARK_SEED);
+	boost::uniform_int<unsigned long> distribution(0, v - 1);
+	boost::variate_generator<boost::mt19937&, boost::uniform_int<unsigned long> > rand(rng, distribution);
+	
+	std::vector<Subset> result;
+	result.reserve(count);
+	while (result.size() < count) {
+		Subset B;
+		while (B.size() < k) B.insert(rand());
+		result.push_back(B);
+	}
+	return result;
+}
+
+/**
+ * Runs the Kramer-Mesner construction for 2-subsets up to k-subsets, and returns the output of every level.  Both
+ * reference groups are transitive, so {0} is the only orbit representative of the singletons.
+ */
+std::vector<KMBuilderOutput> buildLevels(const Group& G, unsigned int k, const PrunerSelector& selector) {
+	std::vector<KMBuilderOutput> outputs;
+	for (unsigned int i = 2; i <= k; i++) {
+		std::vector<Subset> orbitReps;
+		boost::any prunerData;
+		if (i == 2) {
+			unsigned long point = 0;
+			orbitReps.push_back(makeSingletonSet(point));
+		} else {
+			orbitReps = outputs.back().getNewReps();
+			prunerData = outputs.back().getPrunerData();
+		}
+		
+		KMBuilder builder(G, i, orbitReps, prunerData, selector);
+		outputs.push_back(builder.build());
+	}
+	return outputs;
+}
+
+/* ********************************************************************************************************** */
+struct GroupIteration {
+	boost::shared_ptr<const Group> G;
+	
+	explicit GroupIteration(const boost::shared_ptr<const Group>& G_) : G(G_) {}
+	
+	unsigned long operator()() const {
+		unsigned long result = 0;
+		GroupElementIterator end = G->elementsEnd();
+		for (GroupElementIterator it = G->elementsBegin(); it != end; ++it) {
+			result += (*it).at(0);
+		}
+		return result;
+	}
+};
+
+struct BurnsideSweep {
+	boost::shared_ptr<const Group> G;
+	unsigned int kmax;
+	
+	BurnsideSweep(const boost::shared_ptr<const Group>& G_, unsigned int kmax_) : G(G_), kmax(kmax_) {}
+	
+	unsigned long operator()() const {
+		G->burnsideAll(kmax);
+		return G->burnside(kmax);
+	}
+};
+
+struct BurnsideLookup {
+	boost::shared_ptr<const Group> G;
+	unsigned int k;
+	
+	BurnsideLookup(const boost::shared_ptr<const Group>& G_, unsigned int k_) : G(G_), k(k_) {}
+	
+	unsigned long operator()() const { return G->burnside(k); }
+};
+
+/**
+ * Evaluates a G-invariant function over a list of subsets.  A cold evaluation drops the cached results of the
+ * function first, so that every subset is evaluated from scratch.
+ */
+struct Evaluation {
+	GInvariant::ptr fn;
+	const std::vector<Subset>* subsets;
+	bool cold;
+	
+	Evaluation(const GInvariant::ptr& fn_, const std::vector<Subset>& subsets_, bool cold_) : fn(fn_), subsets(&subsets_), cold(cold_) {}
+	
+	unsigned long operator()() const {
+		if (cold) fn->dropCachedResults();
+		
+		unsigned long result = 0;
+		for (std::vector<Subset>::const_iterator it = subsets->begin(); it != subsets->end(); ++it) {
+			result += fn->evaluate(*it);
+		}
+		return result;
+	}
+};
+
+/* ********************************************************************************************************** */
+typedef StdMapCache<unsigned long, unsigned long>::type ContentionCache;
+
+struct CacheQueries {
+	ContentionCache* cache;
+	unsigned long first;
+	
+	CacheQueries(ContentionCache& cache_, unsigned long first_) : cache(&cache_), first(first_) {}
+	
+	void operator()() const {
+		for (unsigned long i = 0; i < BENCHMARK_CACHE_QUERIES; i++) {
+			cache->query((first + i) % BENCHMARK_CACHE_KEYS)++;
+		}
+	}
+};
+
+/**
+ * Queries one small cache from several threads at once, so that nearly every query contends for its lock.
+ */
+struct CacheContention {
+	std::size_t numThreads;
+	
+	explicit CacheContention(std::size_t numThreads_) : numThreads(numThreads_) {}
+	
+	unsigned long operator()() const {
+		ContentionCache cache;
+		boost::thread_group threads;
+		for (std::size_t i = 0; i < numThreads; i++) {
+			threads.create_thread(CacheQueries(cache, i));
+		}
+		threads.join_all();
+		return cache.size();
+	}
+};
+
+/* ********************************************************************************************************** */
+struct PrunerRun {
+	boost::shared_ptr<const Group> G;
+	PrunerType type;
+	unsigned int k;
+	const std::vector<Subset>* orbitReps;
+	boost::any prunerData;
+	
+	PrunerRun(const boost::shared_ptr<const Group>& G_, PrunerType type_, unsigned int k_, const std::vector<Subset>& orbitReps_, const boost::any& prunerData_) :
+		G(G_), type(type_), k(k_), orbitReps(&orbitReps_), prunerData(prunerData_) {}
+	
+	unsigned long operator()() const {
+		boost::shared_ptr<Pruner> pruner = PrunerSelector().createPruner(type, *G, k, G->burnside(k), *orbitReps, prunerData);
+		pruner->prune();
+		return pruner->getNewReps().size();
+	}
+};
+
+/**
+ * Runs computeKMMatrix(G, t, k) once with the given pruner, and reports its throughput in candidates per second, summed
+ * over the metrics of every level.  The pruner is fixed so that runs stay comparable as the cost model changes.
+ */
+void runEndToEnd(Benchmark& benchmark, const std::string& name, const Group& G, unsigned int t, unsigned int k, PrunerType type) {
+	std::vector<LevelMetrics> metrics;
+	
+	boost::timer::cpu_timer timer;
+	computeKMMatrix(G, t, k, PrunerSelector(type), &metrics);
+	boost::timer::cpu_times elapsed = timer.elapsed();
+	
+	double candidates = 0;
+	for (std::vector<LevelMetrics>::const_iterator it = metrics.begin(); it != metrics.end(); ++it) {
+		candidates += it->getCandidates();
+	}
+	
+	benchmark.report(name, 1, elapsed, candidates);
+}
+
+/* ********************************************************************************************************** */
+int runBenchmarks(std::ostream& out, double minSeconds) {
+	Benchmark benchmark(out, minSeconds);
+	boost::shared_ptr<const Group> pgaml232 = boost::make_shared<Group>(createProjectiveSemilinear232());
+	boost::shared_ptr<const Group> psl35 = boost::make_shared<Group>(createProjectiveSpecialLinear35());
+	
+	// Group elements and Burnside counting.  Orbit counts are cached per group, so only the first sweep is timed.
+	benchmark.run("GroupElementIterator/PGammaL(2,32)", GroupIteration(pgaml232), pgaml232->order());
+	benchmark.run("GroupElementIterator/PSL(3,5)", GroupIteration(psl35), psl35->order());
+	benchmark.runOnce("Group::burnsideAll/PGammaL(2,32)/8", BurnsideSweep(pgaml232, 8), pgaml232->order());
+	benchmark.runOnce("Group::burnsideAll/PSL(3,5)/8", BurnsideSweep(psl35, 8), psl35->order());
+	benchmark.run("Group::burnside/cached", BurnsideLookup(pgaml232, 8));
+	
+	// G-invariant evaluation on 6-subsets of PGammaL(2,32)
+	std::vector<Subset> subsets = randomSubsets(pgaml232->getNumPoints(), 6, BENCHMARK_NUM_SUBSETS);
+	SplitMix64 anchorRng(BENCHMARK_SEED);
+	GInvariant::ptr anchorSet = AnchorSet::buildAnchorSet(*pgaml232, pgaml232->getNumPoints() / 2, anchorRng);
+	benchmark.run("AnchorSet::evaluate/cold", Evaluation(anchorSet, subsets, true), subsets.size());
+	benchmark.run("AnchorSet::evaluate/warm", Evaluation(anchorSet, subsets, false), subsets.size());
+	
+	// The levels up to 5-subsets, built with TablePruner so that the last one leaves a Discriminator behind
+	std::vector<KMBuilderOutput> levels = buildLevels(*pgaml232, 5, PrunerSelector(TABLE_PRUNER));
+	const std::vector<Subset> orbitReps = levels.back().getNewReps();
+	boost::any prunerData = levels.back().getPrunerData();
+	boost::shared_ptr<Discriminator> discriminator = boost::static_pointer_cast<Discriminator>(boost::any_cast<TablePrunerData>(prunerData).getDiscriminator());
+	GInvariant::ptr taxonomy2 = discriminator->getInvariant();
+	benchmark.run("Taxonomy2::evaluate/cold", Evaluation(taxonomy2, subsets, true), subsets.size());
+	benchmark.run("Taxonomy2::evaluate/warm", Evaluation(taxonomy2, subsets, false), subsets.size());
+	
+	// Lock contention
+	std::size_t numThreads = std::max<std::size_t>(2, ThreadPool::getInstance().numThreads());
+	benchmark.run("MapCache::query/contended", CacheContention(numThreads), double(numThreads) * BENCHMARK_CACHE_QUERIES);
+	
+	// Each pruner on the 6-subsets of PGammaL(2,32)
+	double numCandidates = PrunerSelector().createPruner(MINREP_PRUNER, *pgaml232, 6, pgaml232->burnside(6), orbitReps, prunerData)->getCandidates().size();
+	const PrunerType pruners[] = {TABLE_PRUNER, EXPLICIT_PRUNER, MINREP_PRUNER, SETIMAGE_PRUNER};
+	for (std::size_t i = 0; i < sizeof(pruners) / sizeof(pruners[0]); i++) {
+		benchmark.run(std::string(prunerName(pruners[i])) + "/PGammaL(2,32)/6", PrunerRun(pgaml232, pruners[i], 6, orbitReps, prunerData), numCandidates);
+	}
+	
+	// The whole pipeline
+	runEndToEnd(benchmark, "computeKMMatrix/PGammaL(2,32)/6-8", *pgaml232, 6, 8, TABLE_PRUNER);
+	runEndToEnd(benchmark, "computeKMMatrix/PSL(3,5)/4-5", *psl35, 4, 5, TABLE_PRUNER);
+	
+	return 0;
+}
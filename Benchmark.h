@@ -0,0 +1,70 @@
+#include <ostream>
+#include <string>
+
+#include <boost/timer/timer.hpp>
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+/**
+ * A small benchmark harness.  Each benchmark is a function object taking no arguments and returning an unsigned long,
+ * which is folded into a sink so that the work cannot be optimized away.  The function is called repeatedly until at
+ * least minSeconds of wall-clock time have passed, and the result is written as one line of JSON:
+ *
+ *     {"benchmark":"...","iterations":...,"seconds":...,"nsPerIteration":...,"itemsPerSecond":...}
+ *
+ * where an "item" is whatever unit of work the benchmark names (group elements, evaluations, candidates, ...).
+ */
+class Benchmark {
+public:
+	explicit Benchmark(std::ostream& out_, double minSeconds_ = 1.0) : out(out_), minSeconds(minSeconds_), sink(0) {}
+	
+	/**
+	 * Runs fn until at least minSeconds have passed, and reports the time per call.
+	 *
+	 * @param itemsPerIteration The number of items processed by each call of fn.
+	 */
+	template <class Function>
+	void run(const std::string& name, Function fn, double itemsPerIteration = 1) {
+		unsigned long iterations = 0;
+		boost::timer::cpu_timer timer;
+		do {
+			sink += fn();
+			++iterations;
+		} while (timer.elapsed().wall < minSeconds * 1e9);
+		report(name, iterations, timer.elapsed(), iterations * itemsPerIteration);
+	}
+	
+	/**
+	 * Runs fn exactly once.  This is for work whose result is cached by the pipeline, so that only the first call
+	 * measures anything, and for end-to-end runs that are too long to repeat.
+	 */
+	template <class Function>
+	void runOnce(const std::string& name, Function fn, double items = 1) {
+		boost::timer::cpu_timer timer;
+		sink += fn();
+		report(name, 1, timer.elapsed(), items);
+	}
+	
+	/**
+	 * Reports a run whose work was timed by the caller, such as an end-to-end run that only learns how many items it
+	 * processed once it is done.
+	 */
+	void report(const std::string& name, unsigned long iterations, const boost::timer::cpu_times& elapsed, double items);
+private:
+	std::ostream& out;
+	double minSeconds;
+	volatile unsigned long sink;
+};
+
+/**
+ * Runs the benchmark suite over the reference groups PGammaL(2,32) and PSL(3,5), writing one line per benchmark to out.
+ * This covers group element iteration, Burnside counting, G-invariant evaluation, cache contention, each pruner, and
+ * the whole Kramer-Mesner pipeline.
+ *
+ * @param minSeconds The minimum time spent on each repeated benchmark.
+ * @return 0, as an exit status for main().
+ */
+int runBenchmarks(std::ostream& out, double minSeconds = 1.0);
+
+#endif
@@ -1,13 +1,22 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <set>
+#include <stdexcept>
 #include <utility>
+#include <vector>
 
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/throw_exception.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/chrono/chrono.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #ifndef CACHE_H
 #define CACHE_H
@@ -40,6 +49,16 @@ struct HeapValueFromKeyInsertDelegate {
 	boost::shared_ptr<Value> operator()(const Key& key) const { return boost::shared_ptr<Value>(new Value(key)); }
 };
 
+/**
+ * Delegate for caches whose values are always computed by the caller (see MapCache::query(key, make)), and so are never
+ * computed by the delegate.
+ */
+template <class Value>
+struct UnreachableInsertDelegate {
+	template<class Key>
+	Value operator()(const Key&) const { boost::throw_exception(std::logic_error("Cache value must be computed by the caller")); }
+};
+
 /* ******************************************************************************************** */
 // These are simple mappers that are used in CacheAdapters.  They are used to map the internal Key and Value types to
 // the external Key and Value types.  Specifically, mappers used in mapKey() require that the functor take in a const Key&
@@ -62,6 +81,152 @@ struct DereferenceMapper {
 	T& operator()(const boost::shared_ptr<T>& t) const { return *t; }
 };
 
+/* ******************************************************************************************** */
+// Memory accounting.  approximateMemoryUsage() estimates the number of bytes that a key or value of a cache owns on the
+// heap, not counting its own sizeof().  Types that are stored in caches and own memory should overload it.  Values that
+// are held through a boost::shared_ptr (eg. the subtables of a SizeIndependentLookupTable) are accounted for through their
+// memoryUsage() by valueMemoryUsage(); keys held this way are shared, and are not counted.  A cache also counts what its
+// delegate owns (such as the copy of an Evaluator in each lookup table), so delegates that own memory overload it as well.
+
+static const std::size_t CONTAINER_NODE_OVERHEAD = 4 * sizeof(void*);	// Red-black tree node: colour, parent and children
+
+template <class T>
+std::size_t approximateMemoryUsage(const T&) { return 0; }
+
+template <class T, class Compare, class Allocator>
+std::size_t approximateMemoryUsage(const std::set<T, Compare, Allocator>& s) {
+	return s.size() * (CONTAINER_NODE_OVERHEAD + sizeof(T));
+}
+
+template <class T, class Allocator>
+std::size_t approximateMemoryUsage(const std::vector<T, Allocator>& v) {
+	return v.capacity() * sizeof(T);
+}
+
+template <class Key, class T, class Compare, class Allocator>
+std::size_t approximateMemoryUsage(const std::map<Key, T, Compare, Allocator>& m) {
+	std::size_t bytes = m.size() * (CONTAINER_NODE_OVERHEAD + sizeof(typename std::map<Key, T, Compare, Allocator>::value_type));
+	for (typename std::map<Key, T, Compare, Allocator>::const_iterator it = m.begin(); it != m.end(); ++it) {
+		bytes += approximateMemoryUsage(it->first) + approximateMemoryUsage(it->second);
+	}
+	return bytes;
+}
+
+template <class T>
+std::size_t valueMemoryUsage(const T& value) { return approximateMemoryUsage(value); }
+
+template <class T>
+std::size_t valueMemoryUsage(const boost::shared_ptr<T>& p) {
+	return p ? sizeof(T) + p->memoryUsage() : 0;
+}
+
+/* ******************************************************************************************** */
+/**
+ * A snapshot of the activity of a cache, together with that of the caches stored in it.  Times are in nanoseconds.
+ */
+struct CacheStatistics {
+	boost::uint64_t hits;
+	boost::uint64_t misses;
+	boost::uint64_t contentions;	// Number of times a lock was not immediately available
+	boost::uint64_t lockWaitTime;
+	boost::uint64_t insertTime;		// Time spent computing and inserting values on misses, including nested lookups
+	boost::uint64_t entries;
+	
+	CacheStatistics() : hits(0), misses(0), contentions(0), lockWaitTime(0), insertTime(0), entries(0) {}
+	
+	CacheStatistics& operator+=(const CacheStatistics& rhs) {
+		hits += rhs.hits;
+		misses += rhs.misses;
+		contentions += rhs.contentions;
+		lockWaitTime += rhs.lockWaitTime;
+		insertTime += rhs.insertTime;
+		entries += rhs.entries;
+		return *this;
+	}
+};
+
+/* The number of shards that the hits of each cache are counted in.  Hits are counted on every lookup, including the
+ * lock-free lookups of frozen keys, so each thread counts in the shard picked by its ID, and the shards are only summed
+ * when the statistics are taken.  A power of two.
+ */
+#ifndef MATRIXGENERATOR_CACHE_HIT_SHARDS
+#define MATRIXGENERATOR_CACHE_HIT_SHARDS 8
+#endif
+
+/**
+ * The counters of a single cache.  These are relaxed atomics, so each counter is exact, but they are not necessarily
+ * consistent with each other while the cache is in use.
+ */
+class CacheCounters : public boost::noncopyable {
+	// A hit counter alone on its cache line, so that threads counting in different shards do not contend
+	struct HitShard {
+		boost::atomic<boost::uint64_t> hits;
+		char padding[64 - sizeof(boost::atomic<boost::uint64_t>)];
+		
+		HitShard() : hits(0) {}
+	};
+	
+	HitShard hitShards[MATRIXGENERATOR_CACHE_HIT_SHARDS];
+	boost::atomic<boost::uint64_t> misses;
+	boost::atomic<boost::uint64_t> contentions;
+	boost::atomic<boost::uint64_t> lockWaitTime;
+	boost::atomic<boost::uint64_t> insertTime;
+	
+	static boost::uint64_t nanoseconds(boost::chrono::steady_clock::duration d) {
+		return boost::chrono::duration_cast<boost::chrono::nanoseconds>(d).count();
+	}
+	
+	/**
+	 * Returns the shard of the calling thread.  Thread IDs tend to be aligned addresses, so their hash is mixed before its
+	 * high bits are taken.
+	 */
+	static std::size_t shard() {
+		boost::uint64_t id = boost::hash<boost::thread::id>()(boost::this_thread::get_id());
+		return std::size_t((id * 0x9e3779b97f4a7c15ULL) >> 32) % MATRIXGENERATOR_CACHE_HIT_SHARDS;
+	}
+public:
+	typedef boost::chrono::steady_clock Clock;
+	
+	CacheCounters() : hitShards(), misses(0), contentions(0), lockWaitTime(0), insertTime(0) {}
+	
+	void hit() { hitShards[shard()].hits.fetch_add(1, boost::memory_order_relaxed); }
+	
+	void miss(Clock::duration insertDuration) {
+		misses.fetch_add(1, boost::memory_order_relaxed);
+		insertTime.fetch_add(nanoseconds(insertDuration), boost::memory_order_relaxed);
+	}
+	
+	void lockWait(Clock::duration waitDuration) { lockWaitTime.fetch_add(nanoseconds(waitDuration), boost::memory_order_relaxed); }
+	
+	void contention(Clock::duration waitDuration) {
+		contentions.fetch_add(1, boost::memory_order_relaxed);
+		lockWait(waitDuration);
+	}
+	
+	CacheStatistics snapshot() const {
+		CacheStatistics stats;
+		stats.hits = 0;
+		for (std::size_t i = 0; i < MATRIXGENERATOR_CACHE_HIT_SHARDS; i++) {
+			stats.hits += hitShards[i].hits.load(boost::memory_order_relaxed);
+		}
+		stats.misses = misses.load(boost::memory_order_relaxed);
+		stats.contentions = contentions.load(boost::memory_order_relaxed);
+		stats.lockWaitTime = lockWaitTime.load(boost::memory_order_relaxed);
+		stats.insertTime = insertTime.load(boost::memory_order_relaxed);
+		return stats;
+	}
+};
+
+// Values held through a boost::shared_ptr are assumed to be caches, whose statistics are included in those of the cache
+// holding them
+template <class T>
+void addNestedStatistics(CacheStatistics&, const T&) {}
+
+template <class T>
+void addNestedStatistics(CacheStatistics& stats, const boost::shared_ptr<T>& p) {
+	if (p) stats += p->statistics();
+}
+
 /* ******************************************************************************************** */
 /**
  * Abstract superclass for all evaluation caches.
@@ -100,20 +265,25 @@ struct Cache {
 template <class MapType, class Delegate = DefaultValueInsertDelegate<typename MapType::mapped_type> >
 class MapCache : public Cache<typename MapType::key_type, typename MapType::mapped_type> {
 	MapType cache;
+	MapType overflow;		// Keys added since the cache was last frozen
+	bool frozen;
 	Delegate delegate;
+	CacheCounters counters;
 	
 	// Locking
 	boost::shared_mutex mutex;
 	typedef boost::shared_lock<boost::shared_mutex> ReadLock;
 	typedef boost::upgrade_lock<boost::shared_mutex> RereadLock;
 	typedef boost::upgrade_to_unique_lock<boost::shared_mutex> WriteLock;
+	typedef boost::unique_lock<boost::shared_mutex> WriteOnlyLock;
 public:
 	// Don't you just hate it when you have to redeclare your public typedefs over again?
 	// Even when Cache<typename MapType::key_type, typename MapType::mapped_type>::key_type = MapType::key_type;
 	typedef typename MapType::key_type key_type;
 	typedef typename MapType::mapped_type mapped_type;
 	
-	explicit MapCache(const Delegate& delegate_ = Delegate(), const MapType& cache_ = MapType()) : delegate(delegate_), cache(cache_) {}
+	explicit MapCache(const Delegate& delegate_ = Delegate(), const MapType& cache_ = MapType()) :
+		cache(cache_), overflow(), frozen(false), delegate(delegate_), counters() {}
 	
 	virtual ~MapCache() {}
 	
@@ -121,30 +291,235 @@ public:
 	 * Queries the cache for the existence of the specified key.
 	 */
 	bool contains(const key_type& key) {
-		ReadLock readLock(mutex);
-		return cache.count(key) != 0;
+		if (frozen && cache.count(key) != 0) return true;
+		
+		ReadLock readLock(mutex, boost::defer_lock);
+		acquire(readLock);
+		return unfrozen().count(key) != 0;
 	}
 	
 	/**
 	 * Queries the cache.  If the key already exists in the cache, then the cached value is returned;
 	 * else, a value is computed, placed in the cache, and returned.
 	 */
-	mapped_type& query(const key_type& key) {
-		ReadLock readLock(mutex);					// Read Lock
+	mapped_type& query(const key_type& key) { return query(key, delegate); }
+	
+	/**
+	 * Queries the cache as above, but computes a missing value with make(key) instead of the delegate.  This is for
+	 * caches whose keys do not hold everything that is needed to compute their values (see IdKeyedCache).
+	 */
+	template <class Factory>
+	mapped_type& query(const key_type& key, Factory& make) {
+		if (frozen) {
+			// Frozen keys are never modified, so they can be read without locking
+			typename MapType::iterator it = cache.find(key);
+			if (it != cache.end()) {
+				counters.hit();
+				return it->second;
+			}
+		}
 		
-		if (cache.count(key) == 0) {
+		ReadLock readLock(mutex, boost::defer_lock);	// Read Lock
+		acquire(readLock);
+		MapType& map = unfrozen();
+		
+		if (map.count(key) == 0) {
 			readLock.unlock();
 			
-			RereadLock rereadLock(mutex);			// Reread Lock
-			if (cache.count(key) == 0) {			// If some other thread has not written into the cache while waiting
+			RereadLock rereadLock(mutex, boost::defer_lock);	// Reread Lock
+			acquire(rereadLock);
+			if (map.count(key) == 0) {				// If some other thread has not written into the cache while waiting
+				CacheCounters::Clock::time_point start = CacheCounters::Clock::now();
 				WriteLock writeLock(rereadLock);	// Write Lock - wait again for all the readers to leave
+				CacheCounters::Clock::time_point locked = CacheCounters::Clock::now();
+				
 				// Insert key to cache
-				cache.insert(typename MapType::value_type(key, delegate(key)));
+				map.insert(typename MapType::value_type(key, make(key)));
+				counters.lockWait(locked - start);
+				counters.miss(CacheCounters::Clock::now() - locked);
+			} else {
+				counters.hit();
 			}
 			
 			readLock = rereadLock;					// Downgrade to read lock
+		} else {
+			counters.hit();
 		}
-		return cache[key];
+		return map.find(key)->second;
+	}
+	
+	/**
+	 * Looks up a key without computing a missing value, taking the lock at most once (and not at all for frozen keys).
+	 * Returns a pointer to the cached value, or NULL if there is none.  The pointer is valid for as long as a reference
+	 * returned by query() would be.
+	 */
+	const mapped_type* find(const key_type& key) {
+		if (frozen) {
+			typename MapType::const_iterator it = cache.find(key);
+			if (it != cache.end()) {
+				counters.hit();
+				return &it->second;
+			}
+		}
+		
+		ReadLock readLock(mutex, boost::defer_lock);
+		acquire(readLock);
+		const MapType& map = unfrozen();
+		typename MapType::const_iterator it = map.find(key);
+		if (it == map.end()) return NULL;
+		counters.hit();
+		return &it->second;
+	}
+	
+	/**
+	 * Places a value that was computed elsewhere into the cache, so that later queries do not call the delegate.  If the
+	 * key is already in the cache, the existing value is kept.  Returns the cached value.
+	 */
+	mapped_type& insert(const key_type& key, const mapped_type& value) {
+		if (frozen) {
+			typename MapType::iterator it = cache.find(key);
+			if (it != cache.end()) return it->second;
+		}
+		
+		WriteOnlyLock writeLock(mutex, boost::defer_lock);
+		acquire(writeLock);
+		return unfrozen().insert(typename MapType::value_type(key, value)).first->second;
+	}
+	
+	/**
+	 * Freezes the current contents of the cache.  Queries for frozen keys no longer take the lock; only queries for keys
+	 * that are added afterwards do, until the cache is frozen again.
+	 *
+	 * The cache may be frozen any number of times, but only at points where no other thread is using it (for instance,
+	 * between the levels of the Kramer-Mesner matrix).  References to values added since the last freeze are
+	 * invalidated, unless the values are stored on the heap.
+	 */
+	void freeze() {
+		WriteOnlyLock writeLock(mutex);
+		cache.insert(overflow.begin(), overflow.end());
+		MapType().swap(overflow);
+		frozen = true;
+	}
+	
+	bool isFrozen() const { return frozen; }
+	
+	/**
+	 * Returns the delegate, for clients that compute values themselves and place them with insert().  The delegate is
+	 * otherwise only called with the lock held, so anything such clients use must be thread-safe.
+	 */
+	Delegate& getDelegate() { return delegate; }
+	
+	/**
+	 * Removes a key from the cache, so that its value is computed again if it is queried later.  Returns whether the
+	 * key was in the cache.
+	 *
+	 * Like freeze(), this may only be called where no other thread is using the cache.
+	 */
+	bool erase(const key_type& key) {
+		WriteOnlyLock writeLock(mutex);
+		return cache.erase(key) + overflow.erase(key) != 0;
+	}
+	
+	/**
+	 * Removes every key from the cache.  Like freeze(), this may only be called where no other thread is using the cache.
+	 */
+	void clear() {
+		WriteOnlyLock writeLock(mutex);
+		MapType().swap(cache);
+		MapType().swap(overflow);
+	}
+	
+	/**
+	 * Removes every key whose value satisfies pred, and returns the number of keys removed.  pred may modify the values
+	 * it is called on, but not the cache itself.  Like freeze(), this may only be called where no other thread is using
+	 * the cache.
+	 */
+	template <class Predicate>
+	std::size_t eraseIf(Predicate pred) {
+		WriteOnlyLock writeLock(mutex);
+		return eraseIf(cache, pred) + eraseIf(overflow, pred);
+	}
+	
+	/**
+	 * Calls f on every value in the cache, in no particular order.  f may modify the values, but not the cache itself.
+	 */
+	template <class Function>
+	Function forEachValue(Function f) {
+		ReadLock readLock(mutex);
+		for (typename MapType::iterator it = cache.begin(); it != cache.end(); ++it) f(it->second);
+		for (typename MapType::iterator it = overflow.begin(); it != overflow.end(); ++it) f(it->second);
+		return f;
+	}
+	
+	/**
+	 * Returns the number of keys in the cache.
+	 */
+	std::size_t size() {
+		ReadLock readLock(mutex);
+		return cache.size() + overflow.size();
+	}
+	
+	/**
+	 * Returns an estimate of the number of bytes held by the cache, including the memory owned by its keys, values and
+	 * delegate (see approximateMemoryUsage()).  This walks the whole cache, so it should not be called often.
+	 */
+	std::size_t memoryUsage() {
+		ReadLock readLock(mutex);
+		return approximateMemoryUsage(delegate) + mapMemoryUsage(cache) + mapMemoryUsage(overflow);
+	}
+	
+	/**
+	 * Returns the activity of this cache, together with that of the caches stored in it.  Like memoryUsage(), this walks
+	 * the whole cache.
+	 */
+	CacheStatistics statistics() {
+		CacheStatistics stats = counters.snapshot();
+		
+		ReadLock readLock(mutex);
+		stats.entries += cache.size() + overflow.size();
+		for (typename MapType::const_iterator it = cache.begin(); it != cache.end(); ++it) addNestedStatistics(stats, it->second);
+		for (typename MapType::const_iterator it = overflow.begin(); it != overflow.end(); ++it) addNestedStatistics(stats, it->second);
+		return stats;
+	}
+private:
+	/**
+	 * Locks lock, recording the time spent waiting if it is not immediately available.
+	 */
+	template <class Lock>
+	void acquire(Lock& lock) {
+		if (lock.try_lock()) return;
+		
+		CacheCounters::Clock::time_point start = CacheCounters::Clock::now();
+		lock.lock();
+		counters.contention(CacheCounters::Clock::now() - start);
+	}
+	
+	/**
+	 * Returns the map that new keys are added to.  This must be called with the lock held.
+	 */
+	MapType& unfrozen() { return frozen ? overflow : cache; }
+	
+	template <class Predicate>
+	static std::size_t eraseIf(MapType& map, Predicate& pred) {
+		std::size_t erased = 0;
+		for (typename MapType::iterator it = map.begin(); it != map.end(); ) {
+			if (pred(it->second)) {
+				map.erase(it++);
+				erased++;
+			} else {
+				++it;
+			}
+		}
+		return erased;
+	}
+	
+	static std::size_t mapMemoryUsage(const MapType& map) {
+		std::size_t bytes = 0;
+		for (typename MapType::const_iterator it = map.begin(); it != map.end(); ++it) {
+			bytes += CONTAINER_NODE_OVERHEAD + sizeof(typename MapType::value_type);
+			bytes += approximateMemoryUsage(it->first) + valueMemoryUsage(it->second);
+		}
+		return bytes;
 	}
 };
 
@@ -180,6 +555,35 @@ struct BoostUnorderedMapCache {
 
 /* **************************************************************************************************** */
 
+/**
+ * Functor that applies a ValueMapper before calling another functor.  This is used to pass the values of the internal
+ * cache of a CacheAdapter2 to functors expecting its external value type.
+ */
+template <class Function, class ValueMapper>
+struct MappedValueFunction {
+	Function f;
+	ValueMapper valueMapper;
+	
+	MappedValueFunction(const Function& f_, const ValueMapper& valueMapper_) : f(f_), valueMapper(valueMapper_) {}
+	
+	template <class T>
+	void operator()(T& value) { f(valueMapper(value)); }
+};
+
+/**
+ * Like MappedValueFunction, for predicates.
+ */
+template <class Predicate, class ValueMapper>
+struct MappedValuePredicate {
+	Predicate pred;
+	ValueMapper valueMapper;
+	
+	MappedValuePredicate(const Predicate& pred_, const ValueMapper& valueMapper_) : pred(pred_), valueMapper(valueMapper_) {}
+	
+	template <class T>
+	bool operator()(T& value) { return pred(valueMapper(value)); }
+};
+
 /**
  * An abstract evaluation cache that is backed by an evaluation cache of different types.  This cache contains an internal
  * MapCache for its dirty work.
@@ -212,6 +616,42 @@ public:
 		typename MapType::mapped_type& mappedValue = cache.query(mappedKey);
 		return valueMapper(mappedValue);
 	}
+	
+	/**
+	 * Freezes the internal cache; see MapCache::freeze().
+	 */
+	void freeze() { cache.freeze(); }
+	bool isFrozen() const { return cache.isFrozen(); }
+	
+	/**
+	 * Removes a key from the internal cache; see MapCache::erase().
+	 */
+	bool erase(const key_type& key) {
+		const typename MapType::key_type& mappedKey = keyMapper(key);
+		return cache.erase(mappedKey);
+	}
+	
+	void clear() { cache.clear(); }
+	
+	/**
+	 * Calls f on every (external) value in the cache; see MapCache::forEachValue().
+	 */
+	template <class Function>
+	Function forEachValue(Function f) {
+		return cache.forEachValue(MappedValueFunction<Function, ValueMapper>(f, valueMapper)).f;
+	}
+	
+	/**
+	 * Removes every key whose (external) value satisfies pred; see MapCache::eraseIf().
+	 */
+	template <class Predicate>
+	std::size_t eraseIf(Predicate pred) {
+		return cache.eraseIf(MappedValuePredicate<Predicate, ValueMapper>(pred, valueMapper));
+	}
+	
+	std::size_t size() { return cache.size(); }
+	std::size_t memoryUsage() { return cache.memoryUsage(); }
+	CacheStatistics statistics() { return cache.statistics(); }
 };
 
 /**
@@ -273,4 +713,76 @@ struct HeapValueBoostUnorderedMapCache {
 	typedef boost::unordered_map<Key, boost::shared_ptr<Value>, Hash, Predicate, Allocator> inner_map_type;
 	typedef CacheAdapter2<Key, Value, inner_map_type, IdentityMapper, DereferenceMapper, Delegate> type;
 };
+
+/**
+ * An evaluation cache keyed by the IDs of G-invariant functions (see GInvariant::getId()), rather than by copies of the
+ * functions themselves, which can be large.  The values are heap allocated, and each one is created from the function by
+ * the delegate, the first time its ID is queried.
+ *
+ * @param <Key> The function type, which must have getId().
+ * @param <Delegate> The delegate functor used to create a new value from a function.  It should return
+ *                   boost::shared_ptr<Value>.
+ */
+template <class Key, class Value, class Delegate = HeapValueFromKeyInsertDelegate<Value> >
+class IdKeyedCache : public Cache<Key, Value> {
+	typedef std::map<boost::uint64_t, boost::shared_ptr<Value> > inner_map_type;
+	
+	/**
+	 * Creates the value for the ID of one particular function.
+	 */
+	class KeyInsertDelegate {
+		const Key& key;
+		Delegate& delegate;
+	public:
+		KeyInsertDelegate(const Key& key_, Delegate& delegate_) : key(key_), delegate(delegate_) {}
+		
+		boost::shared_ptr<Value> operator()(const boost::uint64_t&) { return delegate(key); }
+	};
+	
+	MapCache<inner_map_type, UnreachableInsertDelegate<boost::shared_ptr<Value> > > cache;
+	Delegate delegate;
+	DereferenceMapper valueMapper;
+public:
+	typedef Key key_type;
+	typedef Value mapped_type;
+	
+	explicit IdKeyedCache(const Delegate& delegate_ = Delegate()) : cache(), delegate(delegate_), valueMapper() {}
+	
+	bool contains(const key_type& key) { return cache.contains(key.getId()); }
+	
+	mapped_type& query(const key_type& key) {
+		KeyInsertDelegate make(key, delegate);
+		return valueMapper(cache.query(key.getId(), make));
+	}
+	
+	/**
+	 * Freezes the internal cache; see MapCache::freeze().
+	 */
+	void freeze() { cache.freeze(); }
+	bool isFrozen() const { return cache.isFrozen(); }
+	
+	/**
+	 * Removes a function from the internal cache; see MapCache::erase().
+	 */
+	bool erase(const key_type& key) { return cache.erase(key.getId()); }
+	
+	/**
+	 * Removes the function with the given ID, for when no instance of the function is left to call erase() with.
+	 */
+	bool eraseId(boost::uint64_t id) { return cache.erase(id); }
+	
+	void clear() { cache.clear(); }
+	
+	/**
+	 * Calls f on every value in the cache; see MapCache::forEachValue().
+	 */
+	template <class Function>
+	Function forEachValue(Function f) {
+		return cache.forEachValue(MappedValueFunction<Function, DereferenceMapper>(f, valueMapper)).f;
+	}
+	
+	std::size_t size() { return cache.size(); }
+	std::size_t memoryUsage() { return cache.memoryUsage(); }
+	CacheStatistics statistics() { return cache.statistics(); }
+};
 #endif
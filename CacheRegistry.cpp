@@ -0,0 +1,25 @@
+#include <iomanip>
+
+#include "CacheRegistry.h"
+
+void CacheRegistry::report(std::ostream& out) {
+	boost::mutex::scoped_lock lock(mutex);
+	std::ios_base::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+	out << std::fixed;
+	
+	for (std::vector<std::pair<std::string, Reporter> >::const_iterator it = caches.begin(); it != caches.end(); ++it) {
+		Report report = it->second();
+		const CacheStatistics& stats = report.statistics;
+		boost::uint64_t lookups = stats.hits + stats.misses;
+		
+		out << it->first << ": " << stats.entries << " entries, " << (report.bytes >> 20) << " MiB, ";
+		out << stats.hits << "/" << lookups << " hits";
+		if (lookups != 0) out << " (" << std::setprecision(1) << 100.0 * stats.hits / lookups << "%)";
+		out << ", " << stats.contentions << " contended locks (" << std::setprecision(3) << stats.lockWaitTime / 1e9 << "s waiting), ";
+		out << stats.insertTime / 1e9 << "s inserting" << std::endl;
+	}
+	
+	out.flags(flags);
+	out.precision(precision);
+}
@@ -0,0 +1,77 @@
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "Cache.h"
+
+#ifndef CACHEREGISTRY_H
+#define CACHEREGISTRY_H
+
+/**
+ * The evaluation caches whose activity is reported at the end of each level.  The *EvalCache singletons register
+ * themselves when they are created, and each report covers the registered cache together with the caches stored in it
+ * (such as the lookup table of each G-invariant function).
+ *
+ * This is implemented as a "classic singleton", which is guaranteed thread-safe in C++11, but is confined to
+ * single-threaded operation in earlier versions of C++.  It should be thread-safe under C++03 on gcc and clang, the two
+ * compilers used in development.
+ */
+class CacheRegistry : public boost::noncopyable {
+public:
+	/**
+	 * The state of a cache at the time of a report.
+	 */
+	struct Report {
+		CacheStatistics statistics;
+		std::size_t bytes;
+	};
+	
+	static CacheRegistry& getInstance() {
+		static CacheRegistry instance;
+		return instance;
+	}
+	
+	/**
+	 * Registers a cache under the given name.  The cache must outlive every later call to report().
+	 *
+	 * @param <CacheType> A MapCache or CacheAdapter2.
+	 */
+	template <class CacheType>
+	void add(const std::string& name, CacheType& cache) {
+		boost::mutex::scoped_lock lock(mutex);
+		caches.push_back(std::make_pair(name, Reporter(CacheReporter<CacheType>(cache))));
+	}
+	
+	/**
+	 * Writes one line per registered cache to out, with its entries, memory, hit rate, lock contention and the time
+	 * spent inserting on misses.  This walks every registered cache, so it should only be called between levels.
+	 */
+	void report(std::ostream& out);
+private:
+	CacheRegistry() {}
+	
+	template <class CacheType>
+	struct CacheReporter {
+		CacheType* cache;
+		
+		explicit CacheReporter(CacheType& cache_) : cache(&cache_) {}
+		
+		Report operator()() const {
+			Report report;
+			report.statistics = cache->statistics();
+			report.bytes = cache->memoryUsage();
+			return report;
+		}
+	};
+	
+	typedef boost::function<Report ()> Reporter;
+	std::vector<std::pair<std::string, Reporter> > caches;
+	boost::mutex mutex;
+};
+
+#endif
@@ -0,0 +1,262 @@
+#include "DataflowExecutor.h"
+#include "TaskQueue.h"
+
+/* ********************************************************************************************************** */
+/**
+ * Runs one evaluation of a DataflowExecutor, once its dependencies have finished.
+ */
+class DataflowTask {
+	DataflowExecutor* executor;
+	std::size_t vertex;
+public:
+	DataflowTask(DataflowExecutor& executor_, std::size_t vertex_) : executor(&executor_), vertex(vertex_) {}
+	
+	void operator()() const { executor->run(vertex); }
+};
+
+/**
+ * Runs one batch of evaluations of the function at the inputs of a DataflowExecutor, once their dependencies have
+ * finished.
+ */
+class DataflowBatchTask {
+	DataflowExecutor* executor;
+	std::size_t batch;
+public:
+	DataflowBatchTask(DataflowExecutor& executor_, std::size_t batch_) : executor(&executor_), batch(batch_) {}
+	
+	void operator()() const { executor->runBatch(batch); }
+};
+
+/**
+ * Finds the uncached dependents of a chunk of the newly discovered vertices, adding them and their edges to the graph.
+ * Returns the vertices that this chunk was the first to discover.
+ */
+class DependentDiscoveryChunk {
+	Graph<GInvariantEvaluationTask>* graph;
+	const std::vector<std::size_t>* frontier;
+	std::size_t first, last;
+public:
+	typedef std::vector<std::size_t> result_type;
+	
+	DependentDiscoveryChunk(Graph<GInvariantEvaluationTask>& graph_, const std::vector<std::size_t>& frontier_, std::size_t first_, std::size_t last_) :
+		graph(&graph_), frontier(&frontier_), first(first_), last(last_) {}
+	
+	result_type operator()() const {
+		result_type result;
+		for (std::size_t i = first; i < last; i++) {
+			std::size_t dependent = (*frontier)[i];
+			std::deque<GInvariantEvaluationTask> dependencies = graph->vertex(dependent).getDependents();
+			for (std::deque<GInvariantEvaluationTask>::const_iterator it = dependencies.begin(); it != dependencies.end(); ++it) {
+				bool added;
+				std::size_t dependency = graph->addVertex(*it, added);
+				graph->addEdgeBetween(dependency, dependent);
+				if (added) result.push_back(dependency);
+			}
+		}
+		return result;
+	}
+};
+
+/* ********************************************************************************************************** */
+// DataflowExecutor methods
+
+const std::size_t DataflowExecutor::NO_BATCH;
+
+DataflowExecutor::DataflowExecutor(const GInvariant::ptr& fn, const std::vector<Subset>& inputs) :
+	graph(), roots(), batches(), batchOf(), packed(true), remaining(0) {
+	std::vector<std::size_t> frontier;
+	roots.reserve(inputs.size());
+	for (std::vector<Subset>::const_iterator it = inputs.begin(); it != inputs.end(); ++it) {
+		bool added;
+		roots.push_back(graph.addVertex(GInvariantEvaluationTask(fn, *it), added));
+		if (added) frontier.push_back(roots.back());
+	}
+	
+	// Each vertex is expanded only by the thread that added it, so each edge is added once
+	while (!frontier.empty()) frontier = discover(frontier);
+	makeBatches();
+}
+
+/**
+ * Splits the roots into batches of up to MATRIXGENERATOR_DATAFLOW_BATCH_SIZE consecutive inputs of the same size.
+ */
+void DataflowExecutor::makeBatches() {
+	batchOf.assign(graph.numVertices(), NO_BATCH);
+	for (std::vector<std::size_t>::const_iterator it = roots.begin(); it != roots.end(); ++it) {
+		if (batchOf[*it] != NO_BATCH) continue;		// A repeated input
+		
+		const Subset& input = graph.vertex(*it).getInput();
+		packed = packed && (input.empty() || *input.rbegin() < MAX_PACKED_POINTS);
+		if (batches.empty() || batches.back().size() == MATRIXGENERATOR_DATAFLOW_BATCH_SIZE ||
+			graph.vertex(batches.back().front()).getInput().size() != input.size()) {
+			batches.push_back(std::vector<std::size_t>());
+		}
+		batchOf[*it] = batches.size() - 1;
+		batches.back().push_back(*it);
+	}
+}
+
+std::vector<std::size_t> DataflowExecutor::discover(const std::vector<std::size_t>& frontier) {
+	// A few chunks per thread, so that a slow chunk does not hold up the rest
+	ThreadPool& pool = ThreadPool::getInstance();
+	std::size_t numChunks = std::min<std::size_t>(frontier.size(), std::max<std::size_t>(1, pool.numThreads() * 4));
+	std::size_t chunkSize = (frontier.size() + numChunks - 1) / numChunks;
+	
+	std::vector<boost::shared_future<std::vector<std::size_t> > > futures;
+	for (std::size_t first = 0; first < frontier.size(); first += chunkSize) {
+		DependentDiscoveryChunk chunk(graph, frontier, first, std::min(first + chunkSize, frontier.size()));
+		futures.push_back(pool.schedule(Task<std::vector<std::size_t> >(chunk)));
+	}
+	
+	std::vector<std::size_t> result;
+	for (std::size_t i = 0; i < futures.size(); i++) {
+		const std::vector<std::size_t>& discovered = futures[i].get();
+		result.insert(result.end(), discovered.begin(), discovered.end());
+	}
+	return result;
+}
+
+std::vector<unsigned long> DataflowExecutor::evaluate() {
+	std::size_t n = graph.numVertices();
+	pending.reset(new boost::atomic<std::size_t>[n]);
+	batchPending.reset(new boost::atomic<std::size_t>[batches.size()]);
+	results.reset(new unsigned long[n]);
+	bindAll();
+	remaining.store(n);
+	error = boost::exception_ptr();
+	
+	// Every count must be set before anything runs, as a finished evaluation may release any other
+	std::vector<std::size_t> batchCounts(batches.size());
+	std::vector<std::size_t> ready;
+	for (std::size_t i = 0; i < n; i++) {
+		if (batchOf[i] != NO_BATCH) {
+			batchCounts[batchOf[i]] += graph.inDegree(i);
+		} else {
+			pending[i].store(graph.inDegree(i), boost::memory_order_relaxed);
+			if (graph.inDegree(i) == 0) ready.push_back(i);
+		}
+	}
+	for (std::size_t b = 0; b < batches.size(); b++) {
+		batchPending[b].store(batchCounts[b], boost::memory_order_relaxed);
+	}
+	
+	for (std::vector<std::size_t>::const_iterator it = ready.begin(); it != ready.end(); ++it) {
+		schedule(*it);
+	}
+	for (std::size_t b = 0; b < batches.size(); b++) {
+		if (batchCounts[b] == 0) scheduleBatch(b);
+	}
+	
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		while (remaining.load(boost::memory_order_acquire) != 0) finished.wait(lock);
+		if (error) boost::rethrow_exception(error);
+	}
+	
+	std::vector<unsigned long> result;
+	result.reserve(roots.size());
+	for (std::vector<std::size_t>::const_iterator it = roots.begin(); it != roots.end(); ++it) {
+		result.push_back(results[*it]);
+	}
+	return result;
+}
+
+/**
+ * Binds the function of every vertex, once for each function and size of input.
+ */
+void DataflowExecutor::bindAll() {
+	typedef std::map<std::pair<boost::uint64_t, Subset::size_type>, BoundGInvariant::ptr> BindingMap;
+	BindingMap bound;
+	
+	std::size_t n = graph.numVertices();
+	bindings.resize(n);
+	for (std::size_t i = 0; i < n; i++) {
+		const GInvariantEvaluationTask& task = graph.vertex(i);
+		std::pair<boost::uint64_t, Subset::size_type> key(task.getFnId(), task.getInput().size());
+		BindingMap::iterator it = bound.find(key);
+		if (it == bound.end()) it = bound.insert(std::make_pair(key, task.getFn()->bind(key.second))).first;
+		bindings[i] = it->second;
+	}
+}
+
+void DataflowExecutor::schedule(std::size_t vertex) {
+	ThreadPool::getInstance().schedule(Task<void>(DataflowTask(*this, vertex)));
+}
+
+void DataflowExecutor::scheduleBatch(std::size_t batch) {
+	ThreadPool::getInstance().schedule(Task<void>(DataflowBatchTask(*this, batch)));
+}
+
+void DataflowExecutor::run(std::size_t vertex) {
+	try {
+		results[vertex] = bindings[vertex]->evaluate(graph.vertex(vertex).getInput());
+	} catch (...) {
+		boost::mutex::scoped_lock lock(mutex);
+		if (!error) error = boost::current_exception();
+	}
+	
+	release(vertex);
+	finish(1);
+}
+
+void DataflowExecutor::runBatch(std::size_t batch) {
+	const std::vector<std::size_t>& vertices = batches[batch];
+	try {
+		if (packed) {
+			// Every vertex in the batch is the same function at the same size of input, so they share a binding
+			std::vector<PackedSubset> inputs(vertices.size());
+			std::vector<unsigned long> values(vertices.size());
+			for (std::size_t i = 0; i < vertices.size(); i++) {
+				inputs[i] = packSubset(graph.vertex(vertices[i]).getInput());
+			}
+			bindings[vertices.front()]->evaluateBatch(&inputs[0], inputs.size(), &values[0]);
+			for (std::size_t i = 0; i < vertices.size(); i++) {
+				results[vertices[i]] = values[i];
+			}
+		} else {
+			for (std::vector<std::size_t>::const_iterator it = vertices.begin(); it != vertices.end(); ++it) {
+				results[*it] = bindings[*it]->evaluate(graph.vertex(*it).getInput());
+			}
+		}
+	} catch (...) {
+		boost::mutex::scoped_lock lock(mutex);
+		if (!error) error = boost::current_exception();
+	}
+	
+	for (std::vector<std::size_t>::const_iterator it = vertices.begin(); it != vertices.end(); ++it) {
+		release(*it);
+	}
+	finish(vertices.size());
+}
+
+/**
+ * Continues with every dependent (or batch of dependents) that vertex was the last dependency of.
+ */
+void DataflowExecutor::release(std::size_t vertex) {
+	std::vector<std::size_t> dependents = graph.successors(vertex);
+	for (std::vector<std::size_t>::const_iterator it = dependents.begin(); it != dependents.end(); ++it) {
+		std::size_t batch = batchOf[*it];
+		if (batch != NO_BATCH) {
+			if (batchPending[batch].fetch_sub(1, boost::memory_order_acq_rel) == 1) scheduleBatch(batch);
+		} else {
+			if (pending[*it].fetch_sub(1, boost::memory_order_acq_rel) == 1) schedule(*it);
+		}
+	}
+}
+
+/**
+ * Counts off count finished evaluations, and wakes up evaluate() once they are all done.  As soon as the count reaches
+ * zero, evaluate() may return and the executor may be destroyed, so the last evaluations are counted off while holding
+ * the mutex, which evaluate() cannot get past until this has let go of it.
+ */
+void DataflowExecutor::finish(std::size_t count) {
+	std::size_t current = remaining.load(boost::memory_order_relaxed);
+	while (current != count) {
+		if (remaining.compare_exchange_weak(current, current - count, boost::memory_order_acq_rel)) return;
+	}
+	
+	// Every other evaluation has been counted off already, so nothing else changes remaining from here on
+	boost::mutex::scoped_lock lock(mutex);
+	remaining.store(0, boost::memory_order_release);
+	finished.notify_all();
+}
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <boost/atomic.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "AdjacencyList.h"
+#include "GInvariant.h"
+
+#ifndef DATAFLOWEXECUTOR_H
+#define DATAFLOWEXECUTOR_H
+
+/* The number of inputs at which the function is evaluated together, as one batch (see GInvariant::evaluateBatch()), once
+ * the dependencies of all of them have finished.
+ */
+#ifndef MATRIXGENERATOR_DATAFLOW_BATCH_SIZE
+#define MATRIXGENERATOR_DATAFLOW_BATCH_SIZE 64
+#endif
+
+/**
+ * Evaluates a G-invariant function over many inputs by running the graph of its dependencies as a dataflow.
+ *
+ * The constructor discovers every uncached evaluation that the function needs at its inputs (see
+ * GInvariant::getDependents()), in parallel, and interns each one once in a Graph, with an edge from each evaluation to
+ * every evaluation that depends on it.  evaluate() then gives each evaluation an atomic count of its pending
+ * dependencies, and schedules it on the ThreadPool only once that count reaches zero: the evaluations without
+ * dependencies are scheduled first, and each evaluation that finishes schedules the dependents it was the last to
+ * release.  No evaluation ever runs before its dependencies, so none is computed twice, and there is no barrier between
+ * the layers of the graph.  Each function in the graph is bound to its evaluation caches once per size of input (see
+ * GInvariant::bind()), so that the evaluations themselves do not go through the evaluation cache singletons.
+ *
+ * The evaluations of the function at its inputs are the exception: they are grouped into batches of consecutive inputs,
+ * and each batch has a single count of pending dependencies, for all of its evaluations.  Once that reaches zero, the
+ * batch is run through BoundGInvariant::evaluateBatch() if its inputs can be packed, and one evaluation at a time if not.
+ * The function cannot depend on itself, so no batch ever waits on another.
+ */
+class DataflowExecutor : public boost::noncopyable {
+public:
+	/**
+	 * Discovers the evaluations needed for fn at each of inputs.  This must not be called from a task running on the
+	 * ThreadPool.
+	 */
+	DataflowExecutor(const GInvariant::ptr& fn, const std::vector<Subset>& inputs);
+	
+	std::size_t numTasks() const { return graph.numVertices(); }
+	
+	/**
+	 * Runs every evaluation, and returns the values of the function at its inputs, in the order of the inputs.  If an
+	 * evaluation throws, the rest still run (they compute whatever they are missing themselves), and the first exception
+	 * is rethrown once they are done.  Like the constructor, this must not be called from a task running on the
+	 * ThreadPool.
+	 */
+	std::vector<unsigned long> evaluate();
+	
+	template <class OutputIterator>
+	OutputIterator evaluate(OutputIterator result) {
+		std::vector<unsigned long> values = evaluate();
+		return std::copy(values.begin(), values.end(), result);
+	}
+private:
+	Graph<GInvariantEvaluationTask> graph;					// Edges go from each evaluation to those that depend on it
+	std::vector<std::size_t> roots;							// The vertex of the function at each input
+	std::vector<std::vector<std::size_t> > batches;			// The roots, without duplicates, in batches of one size
+	std::vector<std::size_t> batchOf;						// The batch of each vertex, or NO_BATCH if it is not a root
+	bool packed;											// Whether every input fits in a PackedSubset
+	
+	static const std::size_t NO_BATCH = std::size_t(-1);
+	
+	// Set up by evaluate()
+	boost::scoped_array<boost::atomic<std::size_t> > pending;	// Dependencies that have yet to finish, per vertex
+	boost::scoped_array<boost::atomic<std::size_t> > batchPending;	// Dependencies that have yet to finish, per batch
+	boost::scoped_array<unsigned long> results;
+	std::vector<BoundGInvariant::ptr> bindings;				// The function of each vertex, bound to its caches
+	boost::atomic<std::size_t> remaining;					// Evaluations that have yet to finish
+	boost::mutex mutex;										// Guards error, and the wait for remaining to reach zero
+	boost::condition_variable finished;
+	boost::exception_ptr error;
+	
+	friend class DataflowTask;
+	friend class DataflowBatchTask;
+	void schedule(std::size_t vertex);
+	void scheduleBatch(std::size_t batch);
+	void run(std::size_t vertex);
+	void runBatch(std::size_t batch);
+	void release(std::size_t vertex);
+	void finish(std::size_t count);
+	
+	std::vector<std::size_t> discover(const std::vector<std::size_t>& frontier);
+	void makeBatches();
+	void bindAll();
+};
+
+#endif
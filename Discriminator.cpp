@@ -2,8 +2,8 @@
 #include <boost/noncopyable.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/unordered_map.hpp>
-#include <boost/iterator/indirect_iterator.hpp>
 
+#include "CacheRegistry.h"
 #include "Discriminator.h"
 #include "LookupTable.h"
 #include "Taxonomy2.h"
@@ -49,27 +49,118 @@ public:
 		
 		return translator.find(fv)->second;		// The translator table is fully-built
 	}
+	
+	std::size_t memoryUsage() const { return approximateMemoryUsage(translator); }
 private:
 	DiscriminatorEvaluator eval;
 	std::map<FrequencyVector, unsigned long> translator;
 };
 
 /**
- * Simple structure storing both a lookup table as well as a Taxonomy2.  Each Discriminator is associated with one each
- * of both of these.  The Taxonomy2 is created whenever this is created, but is otherwise "lazy" (as in, only when
- * DiscriminatorEvalCache creates an entry for the Discriminator).
+ * The lookup table of a Discriminator, for subsets that are not in its packed starting evaluation cache.  If v >
+ * MAX_PACKED_POINTS, there is no packed cache, and the lookup table is seeded with the unpacked one instead.
  */
-class DiscriminatorEvalCacheEntry {
+class DiscriminatorResultCache : public LookupTable<DiscriminatorEvaluator>::type {
+	typedef LookupTable<DiscriminatorEvaluator>::type super_type;
+	typedef EvaluationDelegate<DiscriminatorEvaluator> delegate_type;
 public:
-	DiscriminatorEvalCacheEntry(const Discriminator& fn) : invariant(new Taxonomy2(fn.getGroup(), fn.shared_from_this())), resultCache(EvaluationDelegate<DiscriminatorEvaluator>(fn.createEvaluator(), fn.lookupTable), fn.newCache) {}
-	
-	boost::shared_ptr<Taxonomy2> getInvariant() const { return invariant; }
-	LookupTable<DiscriminatorEvaluator>::type& getResultCache() { return resultCache; }
-private:
-	LookupTable<DiscriminatorEvaluator>::type resultCache;
-	boost::shared_ptr<Taxonomy2> invariant;
+	DiscriminatorResultCache(const Discriminator& fn, const std::map<DiscriminatorEvaluator::FrequencyVector, unsigned long>& lookupTable, const std::map<Subset, unsigned long>& unpackedCache) :
+		super_type(delegate_type(fn.createEvaluator(), lookupTable), unpackedCache) {}
 };
 
+/* **************************************************************************************************** */
+// DiscriminatorEvalCacheEntry methods
+
+/**
+ * Creates the lookup table for a Discriminator, and takes over its starting evaluation cache.  The Taxonomy2 is created
+ * lazily, the first time it is asked for.
+ */
+DiscriminatorEvalCacheEntry::DiscriminatorEvalCacheEntry(Discriminator& fn_) :
+	subsetSize(fn_.getSubsetSize()), resultCache(new DiscriminatorResultCache(fn_, fn_.lookupTable, fn_.unpackedCache)),
+	fn(fn_.shared_from_this()), invariant(), invariantMutex(),
+	packed(fn_.getGroup().getNumPoints() <= MAX_PACKED_POINTS), packedIndex() {
+	packedIndex.swap(fn_.newCache);
+	std::map<Subset, unsigned long>().swap(fn_.unpackedCache);
+}
+
+DiscriminatorEvalCacheEntry::~DiscriminatorEvalCacheEntry() {}
+
+boost::shared_ptr<Taxonomy2> DiscriminatorEvalCacheEntry::getInvariant() {
+	boost::mutex::scoped_lock lock(invariantMutex);
+	boost::shared_ptr<Taxonomy2> result = invariant.lock();
+	if (!result) {
+		result.reset(new Taxonomy2(fn->getGroup(), fn, shared_from_this()));
+		invariant = result;
+	}
+	return result;
+}
+
+unsigned long DiscriminatorEvalCacheEntry::evaluate(const Subset& B) {
+	if (packed) {
+		const unsigned long* result = packedIndex.find(packSubset(B));
+		if (result) return *result;
+	}
+	return resultCache->query(B);
+}
+
+bool DiscriminatorEvalCacheEntry::hasCachedResult(const Subset& B) {
+	return (packed && packedIndex.contains(packSubset(B))) || resultCache->contains(B);
+}
+
+/**
+ * Evaluates the Discriminator on each of n packed subsets.  The starting index is consulted for all of the subsets first,
+ * and only the subsets that were not found go through the lookup table (which locks unless their results are frozen).
+ *
+ * Precondition: isPacked()
+ */
+void DiscriminatorEvalCacheEntry::evaluateBatch(const PackedSubset* subsets, std::size_t n, unsigned long* results) {
+	const unsigned long NOT_FOUND = ~0UL;
+	
+	// Issue all of the loads first, so that the probes below overlap their cache misses
+	for (std::size_t i = 0; i < n; i++) {
+		packedIndex.prefetch(subsets[i]);
+	}
+	
+	bool allFound = true;
+	for (std::size_t i = 0; i < n; i++) {
+		const unsigned long* result = packedIndex.find(subsets[i]);
+		results[i] = result ? *result : NOT_FOUND;
+		allFound = allFound && result;
+	}
+	if (allFound) return;
+	
+	for (std::size_t i = 0; i < n; i++) {
+		if (results[i] == NOT_FOUND) results[i] = resultCache->query(unpackSubset(subsets[i]));
+	}
+}
+
+/**
+ * Freezes the lookup table, so that results that are already known are read without locking.
+ */
+void DiscriminatorEvalCacheEntry::freeze() {
+	resultCache->freeze();
+}
+
+CacheStatistics DiscriminatorEvalCacheEntry::statistics() {
+	CacheStatistics stats = resultCache->statistics();
+	stats.entries += packedIndex.size();
+	return stats;
+}
+
+std::size_t DiscriminatorEvalCacheEntry::memoryUsage() {
+	return resultCache->memoryUsage() + packedIndex.memoryUsage();
+}
+
+void DiscriminatorEvalCacheEntry::retire() {
+	resultCache->clear();
+	DiscriminatorStartingCache().swap(packedIndex);
+}
+
+void DiscriminatorEvalCacheEntry::release() {
+	getInvariant()->dropCachedResults();
+	fn->retiredEntry = shared_from_this();
+}
+
 /**
  * Alternative to GInvariantInsertDelegate to account for the unique Discriminator requirements.
  */
@@ -98,9 +189,9 @@ public:
 		static DiscriminatorEvalCache instance;
 		return instance;
 	}
-	
+
 private:
-	DiscriminatorEvalCache() {}
+	DiscriminatorEvalCache() { CacheRegistry::getInstance().add("DiscriminatorEvalCache", *this); }
 };
 
 /* **************************************************************************************************** */
@@ -110,41 +201,37 @@ private:
  * Constructs the Taxonomy 2 G-invariant function lazily.
  */
 const GInvariant::ptr Discriminator::getInvariant() const {
-	DiscriminatorEvalCacheEntry& cache = DiscriminatorEvalCache::getInstance().query(*const_cast<Discriminator*>(this));
-	return cache.getInvariant();
+	return getCacheEntry()->getInvariant();
+}
+
+/**
+ * Returns the cache entry of this Discriminator.  A retired entry is no longer in DiscriminatorEvalCache, but it stays in
+ * use for as long as a Taxonomy2 holds on to it, so that the two never evaluate through different entries.
+ */
+boost::shared_ptr<DiscriminatorEvalCacheEntry> Discriminator::getCacheEntry() const {
+	boost::shared_ptr<DiscriminatorEvalCacheEntry> entry = retiredEntry.lock();
+	if (entry) return entry;
+	return DiscriminatorEvalCache::getInstance().query(*const_cast<Discriminator*>(this)).shared_from_this();
 }
 
 /**
- * Tests two Discriminators for equality.
+ * Interns the identity of this Discriminator.
  *
  * Technically, two Discriminators over the same group are "semantically equal" if they work on the same
  * size of Subset, (ie. if both discriminate the same subset size), but under the GInvariant convention
  * but we need to ensure that if *this == rhs, then evaluate(B) == rhs.evaluate(B) for every appropriate
  * Subset B.  We don't know exactly when this occurs (there could be, and likely is, two different
  * function lists for which evaluate() returns the same values), so the best we can do is say that two 
- * Discriminators are equal if and only if they have the same function list.
+ * Discriminators are equal if and only if they discriminate the same subset size with the same function list.
  */
-bool Discriminator::equals(const GInvariant& rhs) const {
-	if (!GInvariant::equals(rhs)) return false;
-	const Discriminator& other = static_cast<const Discriminator&>(rhs);
-	
-	// "Deep-compare" functions and other.functions for equality
-	if (functions.size() != other.functions.size()) return false;
-	for (int i = 0; i < functions.size(); i++) {
-		if (!functions[i]->equals(*other.functions[i])) return false;
+void Discriminator::internIdentity() {
+	std::vector<boost::uint64_t> data;
+	data.reserve(functions.size() + 1);
+	data.push_back(k);
+	for (GInvariantList::const_iterator it = functions.begin(); it != functions.end(); ++it) {
+		data.push_back((*it)->getId());
 	}
-	return true;
-}
-
-std::size_t Discriminator::hash() const {
-	std::size_t seed = 0;
-	boost::hash_combine(seed, getGroup());
-	
-	// Hash the actual functions, not the pointers to them
-	typedef boost::indirect_iterator<GInvariantList::const_iterator> Iterator;
-	boost::hash_range(seed, Iterator(functions.begin()), Iterator(functions.end()));
-	
-	return seed;
+	intern(data);
 }
 
 Discriminator::Evaluator Discriminator::createEvaluator() const {
@@ -152,14 +239,65 @@ Discriminator::Evaluator Discriminator::createEvaluator() const {
 }
 
 unsigned long Discriminator::evaluate(const Subset& B) const {
-	DiscriminatorEvalCacheEntry& cache = DiscriminatorEvalCache::getInstance().query(*const_cast<Discriminator*>(this));
+	return getCacheEntry()->evaluate(B);
+}
+
+/**
+ * Bound Discriminator, which evaluates straight from its cache entry.
+ */
+class DiscriminatorBinding : public BoundGInvariant {
+	boost::shared_ptr<DiscriminatorEvalCacheEntry> entry;
+public:
+	explicit DiscriminatorBinding(const boost::shared_ptr<DiscriminatorEvalCacheEntry>& entry_) : entry(entry_) {}
+	
+	unsigned long evaluate(const Subset& B) const { return entry->evaluate(B); }
 	
-	return cache.getResultCache().query(B);
+	void evaluateBatch(const PackedSubset* subsets, std::size_t n, unsigned long* results) const {
+		if (entry->isPacked()) {
+			entry->evaluateBatch(subsets, n, results);
+		} else {
+			BoundGInvariant::evaluateBatch(subsets, n, results);
+		}
+	}
+};
+
+/**
+ * Discriminators only work on one size of subsets, so the size is not needed to find their cache entry.
+ */
+BoundGInvariant::ptr Discriminator::bind(Subset::size_type) const {
+	return BoundGInvariant::ptr(new DiscriminatorBinding(getCacheEntry()));
 }
 
 bool Discriminator::hasCachedResult(const Subset& B) const {
-	DiscriminatorEvalCacheEntry& cache = DiscriminatorEvalCache::getInstance().query(*const_cast<Discriminator*>(this));
-	return cache.getResultCache().contains(B);
+	return getCacheEntry()->hasCachedResult(B);
+}
+
+/**
+ * Predicate that retires the cache entries of Discriminators over subsets that are too small.  The Taxonomy2 of such a
+ * Discriminator works on subsets one point larger, so its entry is only picked out to be removed from the cache (along
+ * with the cache of the Taxonomy2) once those are too small as well.
+ */
+class DiscriminatorRetirement {
+	Subset::size_type size;
+public:
+	explicit DiscriminatorRetirement(Subset::size_type size_) : size(size_) {}
+	
+	bool operator()(DiscriminatorEvalCacheEntry& entry) const {
+		if (entry.getSubsetSize() >= size) return false;
+		entry.retire();
+		if (entry.getSubsetSize() + 1 >= size) return false;
+		entry.release();
+		return true;
+	}
+};
+
+void Discriminator::retireBelow(Subset::size_type size) {
+	DiscriminatorEvalCache::getInstance().eraseIf(DiscriminatorRetirement(size));
+}
+
+void Discriminator::freeze() const {
+	getCacheEntry()->freeze();
+	DiscriminatorEvalCache::getInstance().freeze();
 }
 
 std::deque<GInvariantEvaluationTask> Discriminator::getDependents(const Subset& B) const {
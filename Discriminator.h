@@ -1,13 +1,34 @@
 #include <map>
 
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+#include "Cache.h"
 #include "GInvariant.h"
+#include "PackedSubsetTable.h"
+#include "PerfectSubsetIndex.h"
 
 #ifndef DISCRIMINATOR_H
 #define DISCRIMINATOR_H
 
+/* The following macro indexes a Discriminator's starting evaluation cache with a minimal perfect hash, in place of the
+ * PackedSubsetTable it is built from.  The perfect hash is faster to read, but takes longer to build, so it only pays off
+ * if the Discriminator is evaluated many times over.
+ */
+//#define MATRIXGENERATOR_PERFECT_HASH
+
+#ifdef MATRIXGENERATOR_PERFECT_HASH
+typedef PerfectSubsetIndex DiscriminatorStartingCache;
+#else
+typedef PackedSubsetTable DiscriminatorStartingCache;
+#endif
+
 class Taxonomy2;
 class DiscriminatorEvaluator;
 class DiscriminatorEvalCacheEntry;
+class DiscriminatorResultCache;
 
 typedef std::vector<GInvariant::ptr> GInvariantList;
 
@@ -29,14 +50,23 @@ public:
 	typedef boost::shared_ptr<Discriminator> ptr;
 	typedef DiscriminatorEvaluator Evaluator;
 	
-	Discriminator(const Group& _G, GInvariantList& _functions, const LookupTable& _lookupTable, const std::map<Subset, unsigned long>& _newCache) :
-		GInvariant(_G), functions(_functions), lookupTable(_lookupTable), newCache(_newCache) {}
+	/**
+	 * @param k The size of the subsets being discriminated.
+	 * @param newCache The starting evaluation cache, keyed by packed subsets.  Its contents are moved into the
+	 *                 Discriminator (and indexed, if MATRIXGENERATOR_PERFECT_HASH is defined), leaving it empty.
+	 * @param unpackedCache The starting evaluation cache if v > MAX_PACKED_POINTS, when newCache is empty.  Its contents
+	 *                      are moved into the Discriminator as well, and seed its lookup table.
+	 */
+	Discriminator(const Group& _G, unsigned int _k, GInvariantList& _functions, const LookupTable& _lookupTable, PackedSubsetTable& _newCache, std::map<Subset, unsigned long>& _unpackedCache) :
+		GInvariant(_G), k(_k), functions(_functions), lookupTable(_lookupTable), newCache(), unpackedCache() {
+		moveInto(_newCache, newCache);
+		unpackedCache.swap(_unpackedCache);
+		internIdentity();
+	}
 	virtual ~Discriminator() {}
 	
 	bool operator==(const Discriminator& rhs) const { return equals(rhs); }
 	bool operator!=(const Discriminator& rhs) const { return !equals(rhs); }
-	bool equals(const GInvariant& rhs) const;
-	std::size_t hash() const;
 	Evaluator createEvaluator() const;
 	
 	/**
@@ -45,16 +75,101 @@ public:
 	 * 0 to numOutputs() - 1.
 	 */
 	unsigned long numOutputs() const { return lookupTable.size(); }
+	unsigned int getSubsetSize() const { return k; }
 	GInvariantList getFunctions() const { return functions; }
 	const GInvariant::ptr getInvariant() const;
 	
 	unsigned long evaluate(const Subset& B) const;
+	BoundGInvariant::ptr bind(Subset::size_type size) const;
 	bool hasCachedResult(const Subset& B) const;
 	std::deque<GInvariantEvaluationTask> getDependents(const Subset& B) const;
+	
+	/**
+	 * Freezes the evaluation caches of this Discriminator (creating its cache entry if needed), so that the results
+	 * computed so far can be read without locking.  See MapCache::freeze() for when this may be called.
+	 */
+	void freeze() const;
+	
+	/**
+	 * Retires the evaluation caches of every Discriminator over subsets of fewer than size points.  Once the subsets of
+	 * their Taxonomy2s are too small as well, their cache entries are removed from DiscriminatorEvalCache, and the caches
+	 * of the Taxonomy2s are dropped.  An entry that a Taxonomy2 still refers to lives on without its results, so a retired
+	 * Discriminator can still be evaluated, only more slowly.  See MapCache::freeze() for when this may be called.
+	 */
+	static void retireBelow(Subset::size_type size);
 private:
+	unsigned int k;
 	GInvariantList functions;
 	LookupTable lookupTable;					// Should be fully constructed when built
-	std::map<Subset, unsigned long> newCache;	// Starting evaluation cache
+	DiscriminatorStartingCache newCache;		// Starting evaluation cache, moved into the cache entry when it is built	
+	std::map<Subset, unsigned long> unpackedCache;	// Starting evaluation cache if v > MAX_PACKED_POINTS, likewise
+	mutable boost::weak_ptr<DiscriminatorEvalCacheEntry> retiredEntry;		// Set when the entry leaves DiscriminatorEvalCache
+	void internIdentity();
+	boost::shared_ptr<DiscriminatorEvalCacheEntry> getCacheEntry() const;
+};
+
+/* ********************************************************************************************************************* */
+/**
+ * The evaluation cache entry for a Discriminator, storing both its results and its Taxonomy2.  Each Discriminator is
+ * associated with one entry, which is created lazily by DiscriminatorEvalCache (an internal supporting class for
+ * Discriminator) and is kept there until the Discriminator is retired.
+ *
+ * Clients that evaluate the same Discriminator many times (ie. Taxonomy2) can hold on to the entry, so that they only
+ * pay for the DiscriminatorEvalCache lookup once.  They share ownership of it, so that it outlives its place in the cache
+ * for as long as they need it.
+ */
+class DiscriminatorEvalCacheEntry : public boost::noncopyable, public boost::enable_shared_from_this<DiscriminatorEvalCacheEntry> {
+public:
+	explicit DiscriminatorEvalCacheEntry(Discriminator& fn);
+	~DiscriminatorEvalCacheEntry();
+	
+	/**
+	 * Returns the Taxonomy2 of the Discriminator.  The Taxonomy2 holds on to this entry, so the entry only keeps a weak
+	 * reference to it, and creates it again if there are none left.
+	 */
+	boost::shared_ptr<Taxonomy2> getInvariant();
+	
+	unsigned long evaluate(const Subset& B);
+	bool hasCachedResult(const Subset& B);
+	
+	/**
+	 * Returns whether evaluateBatch() can be used, which is the case if v <= MAX_PACKED_POINTS.
+	 */
+	bool isPacked() const { return packed; }
+	void evaluateBatch(const PackedSubset* subsets, std::size_t n, unsigned long* results);
+	
+	void freeze();
+	
+	/**
+	 * Empties the lookup table and the starting evaluation cache.  Results are recomputed from the Discriminator's
+	 * functions from then on.
+	 */
+	void retire();
+	
+	/**
+	 * Drops the cache of the Taxonomy2, and hands this entry over to the Discriminator, so that it can be removed from
+	 * DiscriminatorEvalCache.
+	 */
+	void release();
+	unsigned int getSubsetSize() const { return subsetSize; }
+	
+	/**
+	 * Returns the activity of the lookup table; the starting evaluation cache only contributes its entries.  Used by
+	 * CacheRegistry.
+	 */
+	CacheStatistics statistics();
+	std::size_t memoryUsage();
+private:
+	unsigned int subsetSize;
+	boost::scoped_ptr<DiscriminatorResultCache> resultCache;
+	boost::shared_ptr<const Discriminator> fn;
+	boost::weak_ptr<Taxonomy2> invariant;
+	boost::mutex invariantMutex;
+	
+	// The Discriminator's starting evaluation cache.  As it is never written to after construction, it can be read
+	// without locking.
+	bool packed;
+	DiscriminatorStartingCache packedIndex;
 };
 
 /* ********************************************************************************************************************* */
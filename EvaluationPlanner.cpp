@@ -0,0 +1,138 @@
+#include <boost/unordered_set.hpp>
+
+#include "EvaluationPlanner.h"
+#include "TaskQueue.h"
+
+/* ********************************************************************************************************** */
+/**
+ * Runs Chunk(layer, first, last)() over a few chunks of the layer per thread, and returns the results of each chunk in
+ * order.  A few chunks per thread keeps a slow chunk from holding up the rest.
+ */
+template <class Chunk>
+std::vector<typename Chunk::result_type> forEachChunk(const EvaluationPlanner::Layer& layer) {
+	ThreadPool& pool = ThreadPool::getInstance();
+	std::size_t numChunks = std::min<std::size_t>(layer.size(), std::max<std::size_t>(1, pool.numThreads() * 4));
+	std::size_t chunkSize = numChunks ? (layer.size() + numChunks - 1) / numChunks : 0;
+	
+	std::vector<boost::shared_future<typename Chunk::result_type> > futures;
+	for (std::size_t first = 0; first < layer.size(); first += chunkSize) {
+		Chunk chunk(layer, first, std::min(first + chunkSize, layer.size()));
+		futures.push_back(pool.schedule(Task<typename Chunk::result_type>(chunk)));
+	}
+	
+	std::vector<typename Chunk::result_type> results;
+	results.reserve(futures.size());
+	for (std::size_t i = 0; i < futures.size(); i++) {
+		results.push_back(futures[i].get());
+	}
+	return results;
+}
+
+/**
+ * Finds the uncached dependents of a chunk of a layer.
+ */
+class DependentSearchChunk {
+	const EvaluationPlanner::Layer* layer;
+	std::size_t first, last;
+public:
+	typedef EvaluationPlanner::Layer result_type;
+	
+	DependentSearchChunk(const EvaluationPlanner::Layer& layer_, std::size_t first_, std::size_t last_) : layer(&layer_), first(first_), last(last_) {}
+	
+	result_type operator()() const {
+		result_type result;
+		for (std::size_t i = first; i < last; i++) {
+			std::deque<GInvariantEvaluationTask> dependents = (*layer)[i].getDependents();
+			result.insert(result.end(), dependents.begin(), dependents.end());
+		}
+		return result;
+	}
+};
+
+/**
+ * Evaluates a chunk of a layer.  Each function is bound to its caches (see GInvariant::bind()) when the chunk first
+ * comes to it, and the binding is reused for as long as the tasks that follow have the same function and input size.
+ */
+class EvaluationChunk {
+	const EvaluationPlanner::Layer* layer;
+	std::size_t first, last;
+public:
+	typedef std::vector<unsigned long> result_type;
+	
+	EvaluationChunk(const EvaluationPlanner::Layer& layer_, std::size_t first_, std::size_t last_) : layer(&layer_), first(first_), last(last_) {}
+	
+	result_type operator()() const {
+		result_type result;
+		result.reserve(last - first);
+		
+		BoundGInvariant::ptr bound;
+		boost::uint64_t boundId = 0;
+		Subset::size_type boundSize = 0;
+		for (std::size_t i = first; i < last; i++) {
+			const GInvariantEvaluationTask& task = (*layer)[i];
+			if (!bound || task.getFnId() != boundId || task.getInput().size() != boundSize) {
+				boundId = task.getFnId();
+				boundSize = task.getInput().size();
+				bound = task.getFn()->bind(boundSize);
+			}
+			result.push_back(bound->evaluate(task.getInput()));
+		}
+		return result;
+	}
+};
+
+/* ********************************************************************************************************** */
+// EvaluationPlanner methods
+
+EvaluationPlanner::EvaluationPlanner(const GInvariant::ptr& fn, const std::vector<Subset>& inputs) : layers(1) {
+	layers[0].reserve(inputs.size());
+	for (std::vector<Subset>::const_iterator it = inputs.begin(); it != inputs.end(); ++it) {
+		layers[0].push_back(GInvariantEvaluationTask(fn, *it));
+	}
+	
+	Layer dependents = findDependents(layers[0]);
+	while (!dependents.empty()) {
+		layers.push_back(Layer());
+		layers.back().swap(dependents);
+		dependents = findDependents(layers.back());
+	}
+}
+
+/**
+ * Returns the uncached dependents of every task in layer, without duplicates.
+ */
+EvaluationPlanner::Layer EvaluationPlanner::findDependents(const Layer& layer) {
+	std::vector<Layer> chunks = forEachChunk<DependentSearchChunk>(layer);
+	
+	Layer result;
+	boost::unordered_set<GInvariantEvaluationTask> seen;
+	for (std::vector<Layer>::const_iterator it = chunks.begin(); it != chunks.end(); ++it) {
+		for (Layer::const_iterator jt = it->begin(); jt != it->end(); ++jt) {
+			if (seen.insert(*jt).second) result.push_back(*jt);
+		}
+	}
+	return result;
+}
+
+std::size_t EvaluationPlanner::numTasks() const {
+	std::size_t result = 0;
+	for (std::vector<Layer>::const_iterator it = layers.begin(); it != layers.end(); ++it) {
+		result += it->size();
+	}
+	return result;
+}
+
+std::vector<unsigned long> EvaluationPlanner::evaluate() const {
+	// The dependencies are only evaluated for their side effect on the evaluation caches
+	for (std::vector<Layer>::const_reverse_iterator it = layers.rbegin(); it + 1 != layers.rend(); ++it) {
+		forEachChunk<EvaluationChunk>(*it);
+	}
+	
+	std::vector<std::vector<unsigned long> > chunks = forEachChunk<EvaluationChunk>(layers[0]);
+	std::vector<unsigned long> result;
+	result.reserve(layers[0].size());
+	for (std::vector<std::vector<unsigned long> >::const_iterator it = chunks.begin(); it != chunks.end(); ++it) {
+		result.insert(result.end(), it->begin(), it->end());
+	}
+	return result;
+}
@@ -0,0 +1,46 @@
+#include <algorithm>
+#include <vector>
+
+#include "GInvariant.h"
+
+#ifndef EVALUATIONPLANNER_H
+#define EVALUATIONPLANNER_H
+
+/**
+ * Plans the concurrent evaluation of a G-invariant function over many inputs, one layer of dependencies at a time.
+ *
+ * The first layer is the function evaluated at each input.  The uncached dependencies of a layer (see
+ * GInvariant::getDependents()), with duplicates removed, make up the next layer; for a Taxonomy2 row, this is every
+ * (k-1)-subset that the Discriminator has yet to see, followed by the functions of the Discriminator at those subsets.
+ * The layers are then evaluated deepest first, each one in parallel on the ThreadPool, with a barrier between them.
+ * Every evaluation therefore finds the results it depends on already cached, and no dependency is computed twice.
+ */
+class EvaluationPlanner {
+public:
+	typedef std::vector<GInvariantEvaluationTask> Layer;
+	
+	/**
+	 * Plans the evaluation of fn at each of inputs.  The dependencies are searched in parallel.
+	 */
+	EvaluationPlanner(const GInvariant::ptr& fn, const std::vector<Subset>& inputs);
+	
+	std::size_t numLayers() const { return layers.size(); }
+	std::size_t numTasks() const;
+	
+	/**
+	 * Evaluates every layer, and returns the values of the function at its inputs, in the order of the inputs.
+	 */
+	std::vector<unsigned long> evaluate() const;
+	
+	template <class OutputIterator>
+	OutputIterator evaluate(OutputIterator result) const {
+		std::vector<unsigned long> values = evaluate();
+		return std::copy(values.begin(), values.end(), result);
+	}
+private:
+	std::vector<Layer> layers;		// layers[0] is the function itself, and each later layer is needed by the one before
+	
+	static Layer findDependents(const Layer& layer);
+};
+
+#endif
@@ -1,27 +1,196 @@
+#include <set>
+
 #include <boost/functional/hash.hpp>
 
 #include "GInvariant.h"
 
 /**
- * Minimal implementation of an equality comparator.
+ * Interns the identity of this function.
  *
  * In theory, two GInvariants should be equal if for every set B (of suitable size) evaluate(B) ==
  * rhs.evaluate(B).  Since we can't tell a priori whether this is the case, we stick with an easier but
- * more stringent definition.
- * 
- * Two GInvariants are possibly equal if they are over the same group, but definitely different over
- * different groups.  Note that operator==() itself isn't defined over GInvariant to avoid comparing two
- * instances of different GInvariant subclasses; however, subclasses are required to have one, which must
- * call this method.
+ * more stringent definition: two GInvariants are equal if they are of the same type, over the same group,
+ * and built from the same data.  Note that operator==() itself isn't defined over GInvariant to avoid
+ * comparing two instances of different GInvariant subclasses; however, subclasses are required to have
+ * one, which must call equals().
+ */
+void GInvariant::intern(const std::vector<boost::uint64_t>& data) {
+	id = GInvariantRegistry::getInstance().intern(typeid(*this), *G, data);
+}
+
+GInvariant::GInvariant(const GInvariant& rhs) : G(rhs.G), id(rhs.id) {
+	if (id != 0) GInvariantRegistry::getInstance().retain(id);
+}
+
+GInvariant::~GInvariant() {
+	if (id != 0) GInvariantRegistry::getInstance().release(id);
+}
+
+GInvariant& GInvariant::operator=(const GInvariant& rhs) {
+	if (rhs.id != 0) GInvariantRegistry::getInstance().retain(rhs.id);
+	if (id != 0) GInvariantRegistry::getInstance().release(id);
+	G = rhs.G;
+	id = rhs.id;
+	return *this;
+}
+
+/**
+ * Bound function for GInvariants without evaluation caches, which just evaluates the function itself.
  */
-bool GInvariant::equals(const GInvariant& rhs) const {
-	if (typeid(*this) != typeid(rhs)) return false;
-	return G == rhs.G;
+class UncachedBoundGInvariant : public BoundGInvariant {
+	const GInvariant* fn;
+public:
+	explicit UncachedBoundGInvariant(const GInvariant& fn_) : fn(&fn_) {}
+	
+	unsigned long evaluate(const Subset& B) const { return fn->evaluate(B); }
+};
+
+BoundGInvariant::ptr GInvariant::bind(Subset::size_type) const {
+	return BoundGInvariant::ptr(new UncachedBoundGInvariant(*this));
+}
+
+void GInvariant::evaluateBatch(const PackedSubset* subsets, std::size_t n, unsigned long* results) const {
+	if (n != 0) bind(popcount(subsets[0]))->evaluateBatch(subsets, n, results);
 }
 
 std::size_t hash_value(const GInvariantEvaluationTask& task) {
-	std::size_t hash = 0;
-	boost::hash_combine(hash, task.getFn()->hash());
-	boost::hash_combine(hash, task.getInput());
+	std::size_t hash = std::size_t(hashPacked(task.fnId));
+	if (task.packed) {
+		boost::hash_combine(hash, hashPacked(task.packedB));
+	} else {
+		boost::hash_combine(hash, task.B);
+	}
 	return hash;
-}
\ No newline at end of file
+}
+
+/* ********************************************************************************************************************* */
+// GInvariantRegistry methods
+
+bool GInvariantRegistry::Key::operator<(const Key& rhs) const {
+	if (type != rhs.type) return type < rhs.type;
+	if (group != rhs.group) return group < rhs.group;
+	return data < rhs.data;
+}
+
+boost::uint64_t GInvariantRegistry::intern(const std::type_info& type, const Group& G, const std::vector<boost::uint64_t>& data) {
+	Key key;
+	key.type = type.name();
+	key.group = G.getId();
+	key.data = data;
+	
+	boost::mutex::scoped_lock lock(mutex);
+	IdMap::iterator it = ids.lower_bound(key);
+	if (it == ids.end() || ids.key_comp()(key, it->first)) {
+		Entry entry;
+		entry.id = nextId++;
+		entry.instances = 0;
+		it = ids.insert(it, std::make_pair(key, entry));
+		keys[entry.id] = it;
+	}
+	it->second.instances++;
+	return it->second.id;
+}
+
+void GInvariantRegistry::retain(boost::uint64_t id) {
+	boost::mutex::scoped_lock lock(mutex);
+	keys.at(id)->second.instances++;
+}
+
+void GInvariantRegistry::release(boost::uint64_t id) {
+	boost::mutex::scoped_lock lock(mutex);
+	boost::unordered_map<boost::uint64_t, IdMap::iterator>::iterator it = keys.find(id);
+	if (it == keys.end()) return;
+	
+	if (--it->second->second.instances == 0) {
+		ids.erase(it->second);
+		keys.erase(it);
+	}
+}
+
+std::size_t GInvariantRegistry::size() const {
+	boost::mutex::scoped_lock lock(mutex);
+	return ids.size();
+}
+
+/* ********************************************************************************************************************* */
+// EvaluationCacheBudget methods
+
+void EvaluationCacheBudget::touch(const GInvariant::ptr& fn) {
+	boost::mutex::scoped_lock lock(mutex);
+	
+	// Functions that are equal to each other share their cache, so they share a place in the list as well
+	boost::unordered_map<boost::uint64_t, RecencyList::iterator>::iterator it = positions.find(fn->getId());
+	if (it != positions.end()) {
+		recent.splice(recent.begin(), recent, it->second);
+		recent.front().fn = fn;
+	} else {
+		Entry entry;
+		entry.id = fn->getId();
+		entry.fn = fn;
+		entry.dropCache = fn->cacheDropper();
+		recent.push_front(entry);
+		positions[entry.id] = recent.begin();
+	}
+}
+
+void EvaluationCacheBudget::drop(const GInvariant::ptr& fn) {
+	boost::mutex::scoped_lock lock(mutex);
+	boost::unordered_map<boost::uint64_t, RecencyList::iterator>::iterator it = positions.find(fn->getId());
+	if (it != positions.end()) {
+		recent.erase(it->second);
+		positions.erase(it);
+	}
+	fn->dropCachedResults();
+}
+
+std::size_t EvaluationCacheBudget::trim(const std::vector<GInvariant::ptr>& pinned, std::size_t budget) {
+	std::set<boost::uint64_t> pinnedIds;
+	for (std::vector<GInvariant::ptr>::const_iterator it = pinned.begin(); it != pinned.end(); ++it) {
+		pinnedIds.insert((*it)->getId());
+	}
+	
+	boost::mutex::scoped_lock lock(mutex);
+	
+	// Nothing can reach the caches of the functions that are gone, so they are dropped whatever the budget
+	std::size_t bytes = 0;
+	std::vector<std::size_t> usages;
+	for (RecencyList::iterator it = recent.begin(); it != recent.end(); ) {
+		GInvariant::ptr fn = it->fn.lock();
+		if (fn) {
+			usages.push_back(fn->cacheMemoryUsage());
+			bytes += usages.back();
+			++it;
+		} else {
+			if (it->dropCache) it->dropCache();
+			positions.erase(it->id);
+			it = recent.erase(it);
+		}
+	}
+	
+	// Then drop the least recently used caches, one at a time, until the rest fit
+	RecencyList::iterator it = recent.end();
+	std::vector<std::size_t>::const_reverse_iterator usage = usages.rbegin();
+	while (bytes > budget && it != recent.begin()) {
+		--it;
+		if (pinnedIds.count(it->id) != 0) {
+			++usage;
+			continue;
+		}
+		
+		GInvariant::ptr fn = it->fn.lock();
+		if (fn) fn->dropCachedResults();
+		else if (it->dropCache) it->dropCache();
+		bytes -= *usage++;
+		positions.erase(it->id);
+		it = recent.erase(it);
+	}
+	return bytes;
+}
+
+void EvaluationCacheBudget::retireBelow(Subset::size_type size) {
+	boost::mutex::scoped_lock lock(mutex);
+	for (RecencyList::const_iterator it = recent.begin(); it != recent.end(); ++it) {
+		GInvariant::ptr fn = it->fn.lock();
+		if (fn) fn->retireCachedResults(size);
+	}
+}
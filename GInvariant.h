@@ -2,48 +2,127 @@
 #include "Task.h"
 
 #include <deque>
+#include <list>
+#include <map>
+#include <string>
+#include <typeinfo>
+#include <vector>
 
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/future.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/utility/enable_if.hpp>
+#include <boost/weak_ptr.hpp>
 
 #ifndef GINVARIANT_H
 #define GINVARIANT_H
 
+/* The number of bytes that the evaluation caches of G-invariant functions may take up before the caches of the least
+ * recently used functions are dropped (see EvaluationCacheBudget).  The budget is only enforced between levels, so it can
+ * be exceeded while a level is being built.
+ */
+#ifndef MATRIXGENERATOR_CACHE_BUDGET
+#define MATRIXGENERATOR_CACHE_BUDGET (std::size_t(2) << 30)
+#endif
+
 class GInvariantEvaluationTask;
 
+/**
+ * A G-invariant function bound to its evaluation caches, for subsets of one size (see GInvariant::bind()).  A bound
+ * function finds its lookup tables once, when it is bound, rather than through the evaluation cache singletons on every
+ * evaluation, so it suits tight loops over many subsets.
+ *
+ * Bound functions hold on to nothing beyond the lookup tables themselves, so they must not outlive the function, nor be
+ * used once its caches are dropped or retired (see GInvariant::dropCachedResults()).  They are not changed by
+ * evaluate(), so one can be shared between threads.
+ */
+class BoundGInvariant {
+public:
+	typedef boost::shared_ptr<BoundGInvariant> ptr;
+	
+	virtual ~BoundGInvariant() {}
+	
+	/**
+	 * Evaluates the function on the input subset, which must be of the size that the function was bound for.
+	 */
+	virtual unsigned long evaluate(const Subset& B) const = 0;
+	
+	/**
+	 * Evaluates the function on each of n packed subsets, all of the size that the function was bound for, and writes
+	 * the results to results.  Functions override this to share work between the subsets.
+	 *
+	 * The default implementation evaluates each subset in turn.
+	 */
+	virtual void evaluateBatch(const PackedSubset* subsets, std::size_t n, unsigned long* results) const {
+		for (std::size_t i = 0; i < n; i++) {
+			results[i] = evaluate(unpackSubset(subsets[i]));
+		}
+	}
+};
+
 /**
  * A G-invariant function is a function that is fixed by every element in G.
  *
  * This is an abstract base class; specific constructions are detailed in subclasses.
  *
- * Subclasses must implement operator==(), which must call equals() (which may be overridden).
- * Subclasses must also implement hash() in a manner that conforms to the Boost::Hash standard.
+ * Every function is identified by a 64-bit ID, interned by GInvariantRegistry, so that equals() and hash() take
+ * constant time however deep the function is.  The constructor of each concrete subclass must finish by calling
+ * intern() with the data that tells it apart from other functions of its type over the same group; functions with the
+ * same identity share an ID, and so compare equal and share their evaluation caches.  Subclasses must also implement
+ * operator==(), which must call equals().
  */
 class GInvariant {
 public:
 	typedef boost::shared_ptr<GInvariant> ptr;
 	
-	GInvariant(const Group& _G) : G(_G.shared_from_this()) {}
-	virtual ~GInvariant() {}
+	GInvariant(const Group& _G) : G(_G.shared_from_this()), id(0) {}
+	GInvariant(const GInvariant& rhs);
+	virtual ~GInvariant();
+	
+	GInvariant& operator=(const GInvariant& rhs);
 	
 	const Group& getGroup() const { return *G; }
 	
 	/**
-	 * Polymorphic equality function.
+	 * Returns the interned ID of this function (see GInvariantRegistry).
 	 */
-	virtual bool equals(const GInvariant& rhs) const;
+	boost::uint64_t getId() const { return id; }
 	
 	/**
-	 * Polymorphic hash function.  Must be implemented in a manner conforming to the Boost::Hash standard.
+	 * Polymorphic equality function, which compares the interned IDs.
 	 */
-	virtual std::size_t hash() const = 0;
+	bool equals(const GInvariant& rhs) const { return id == rhs.id; }
+	
+	/**
+	 * Polymorphic hash function, conforming to the Boost::Hash standard.
+	 */
+	std::size_t hash() const { return std::size_t(hashPacked(id)); }
 	
 	/**
 	 * Evaluates this G-invariant function on the input subset.
 	 */
 	virtual unsigned long evaluate(const Subset& B) const = 0;
 	
+	/**
+	 * Binds this function to its evaluation caches for subsets of the given size, so that it can be evaluated without
+	 * going through the evaluation cache singletons.
+	 *
+	 * The default implementation, for functions without evaluation caches, simply calls evaluate().
+	 */
+	virtual BoundGInvariant::ptr bind(Subset::size_type size) const;
+	
+	/**
+	 * Evaluates this function on each of n packed subsets, which must all be of the same size, and writes the results to
+	 * results.  This shares work between the subsets where the function can (see BoundGInvariant::evaluateBatch()).
+	 *
+	 * The default implementation binds the function and evaluates the batch through the binding.
+	 */
+	virtual void evaluateBatch(const PackedSubset* subsets, std::size_t n, unsigned long* results) const;
+	
 	/**
 	 * Returns whether the result of the function evaluated over the input subset has previously been calculated.
 	 * This method is only used in parallel execution of GInvariants when organizing the task threads.
@@ -57,37 +136,215 @@ public:
 	 * The default implementation of this is to return an empty list.
 	 */
 	virtual std::deque<GInvariantEvaluationTask> getDependents(const Subset& B) const { return std::deque<GInvariantEvaluationTask>(); }
+	
+	/**
+	 * Returns an estimate of the number of bytes held by the evaluation cache of this function.
+	 *
+	 * The default implementation, for functions without evaluation caches, returns 0.
+	 */
+	virtual std::size_t cacheMemoryUsage() const { return 0; }
+	
+	/**
+	 * Drops the evaluation cache of this function (which is shared with every function equal to it).  Results are
+	 * recomputed if the function is evaluated again.
+	 *
+	 * This may only be called where no evaluations are running, such as between the levels of the Kramer-Mesner matrix.
+	 * The default implementation does nothing.
+	 */
+	virtual void dropCachedResults() const {}
+	
+	/**
+	 * Returns a function that does what dropCachedResults() does, without holding on to this function, so that the
+	 * cache can still be dropped once every instance of the function is gone.  This carries the same restrictions as
+	 * dropCachedResults().
+	 *
+	 * The default implementation, for functions without evaluation caches, returns an empty function.
+	 */
+	virtual boost::function<void ()> cacheDropper() const { return boost::function<void ()>(); }
+	
+	/**
+	 * Drops the cached results of this function for subsets of fewer than size points, which are no longer needed once
+	 * the levels of the Kramer-Mesner matrix have moved past them.  This carries the same restrictions as
+	 * dropCachedResults().
+	 *
+	 * The default implementation does nothing.
+	 */
+	virtual void retireCachedResults(Subset::size_type) const {}
 protected:
 	boost::shared_ptr<const Group> G;
+	
+	/**
+	 * Sets the ID of this function to the one interned for its type, group and data.  This must be called once, at the
+	 * end of the constructor of the concrete subclass.
+	 */
+	void intern(const std::vector<boost::uint64_t>& data);
+private:
+	boost::uint64_t id;
 };
 
 inline std::size_t hash_value(const GInvariant& fn) { return fn.hash(); }
 
+/**
+ * Assigns each distinct G-invariant function an ID, which is then used for O(1) equality and hashing.  The identity of a
+ * function is its concrete type, its group and the data given to GInvariant::intern(): the anchor set of an AnchorSet,
+ * the IDs of the functions of a Discriminator, and so on.
+ *
+ * The registry counts the instances of each function, and forgets its identity once the last of them is gone, so that
+ * the functions drawn and thrown away level after level do not pile up here.  IDs start from 1 and are never reused; a
+ * function that is built again after every instance of it is gone gets a new ID (and so starts with empty caches).
+ *
+ * Groups are told apart by their IDs (see GroupRegistry), so functions over two copies of the same group are equal.
+ *
+ * This is implemented as a "classic singleton", which is guaranteed thread-safe in C++11, but is confined to
+ * single-threaded operation in earlier versions of C++.  It should be thread-safe under C++03 on gcc and clang, the two
+ * compilers used in development.
+ */
+class GInvariantRegistry : public boost::noncopyable {
+public:
+	static GInvariantRegistry& getInstance() {
+		// Never destroyed, as functions held by other singletons release their IDs here when those are destroyed
+		static GInvariantRegistry* instance = new GInvariantRegistry();
+		return *instance;
+	}
+	
+	/**
+	 * Returns the ID of the function with the given identity, assigning it the next ID if it has none yet.
+	 */
+	boost::uint64_t intern(const std::type_info& type, const Group& G, const std::vector<boost::uint64_t>& data);
+	
+	/**
+	 * Counts one more instance of the function with the given ID, such as a copy.
+	 */
+	void retain(boost::uint64_t id);
+	
+	/**
+	 * Counts one less instance of the function with the given ID, and forgets its identity if that was the last one.
+	 */
+	void release(boost::uint64_t id);
+	
+	/**
+	 * Returns the number of functions with at least one instance.
+	 */
+	std::size_t size() const;
+private:
+	struct Key {
+		std::string type;
+		boost::uint64_t group;
+		std::vector<boost::uint64_t> data;
+		
+		bool operator<(const Key& rhs) const;
+	};
+	
+	struct Entry {
+		boost::uint64_t id;
+		std::size_t instances;
+	};
+	
+	typedef std::map<Key, Entry> IdMap;
+	
+	GInvariantRegistry() : ids(), keys(), nextId(1) {}
+	
+	IdMap ids;
+	boost::unordered_map<boost::uint64_t, IdMap::iterator> keys;	// The entry of each ID in ids
+	boost::uint64_t nextId;
+	mutable boost::mutex mutex;
+};
+
+/**
+ * Keeps the evaluation caches of G-invariant functions within MATRIXGENERATOR_CACHE_BUDGET bytes.  Functions are
+ * registered with touch() as they are used.  When trim() finds that their caches take up more than the budget, the caches
+ * of the least recently used functions are dropped, one at a time, until the rest fit.
+ *
+ * The budget only holds weak references, so it does not keep functions alive.  The caches of functions that are gone
+ * can no longer be reached, so trim() drops them first.
+ *
+ * This is implemented as a "classic singleton", which is guaranteed thread-safe in C++11, but is confined to
+ * single-threaded operation in earlier versions of C++.  It should be thread-safe under C++03 on gcc and clang, the two
+ * compilers used in development.
+ */
+class EvaluationCacheBudget : public boost::noncopyable {
+public:
+	static EvaluationCacheBudget& getInstance() {
+		static EvaluationCacheBudget instance;
+		return instance;
+	}
+	
+	/**
+	 * Marks fn as the most recently used function.
+	 */
+	void touch(const GInvariant::ptr& fn);
+	
+	/**
+	 * Drops the cache of fn right away, and forgets about it.  This is for functions that are known to be of no further
+	 * use, and carries the same restrictions as GInvariant::dropCachedResults().
+	 */
+	void drop(const GInvariant::ptr& fn);
+	
+	/**
+	 * Drops the caches of functions that are gone, and then those of the least recently used functions until the rest
+	 * fit in budget bytes, and returns the number of bytes that the remaining caches take up.  The caches of the
+	 * functions in pinned, such as those of the Discriminator in use, are never dropped, even if that leaves the caches
+	 * over budget.  This carries the same restrictions as GInvariant::dropCachedResults().
+	 */
+	std::size_t trim(const std::vector<GInvariant::ptr>& pinned, std::size_t budget = MATRIXGENERATOR_CACHE_BUDGET);
+	
+	/**
+	 * Retires the cached results of every function for subsets of fewer than size points (see
+	 * GInvariant::retireCachedResults()).
+	 */
+	void retireBelow(Subset::size_type size);
+private:
+	EvaluationCacheBudget() {}
+	
+	struct Entry {
+		boost::uint64_t id;
+		boost::weak_ptr<GInvariant> fn;
+		boost::function<void ()> dropCache;		// See GInvariant::cacheDropper()
+	};
+	
+	typedef std::list<Entry> RecencyList;
+	
+	RecencyList recent;		// Most recently used first
+	boost::unordered_map<boost::uint64_t, RecencyList::iterator> positions;		// The place of each function in recent, by ID
+	boost::mutex mutex;
+};
+
 /**
  * This functor simply evaluates a given GInvariant with an input subset.  It is used for the
  * concurrent evaluation of GInvariant functions.
  * 
  * To create the actual task, call the static create() method and pass in the arguments.
+ *
+ * Tasks are compared and hashed by the ID of the function and, where every point fits in a PackedSubset, by the packed
+ * input, both of which are worked out up front; this keeps the deduplication of tasks (see Graph) cheap.
  */
 class GInvariantEvaluationTask {
 	GInvariant::ptr fn;
 	Subset B;
+	boost::uint64_t fnId;
+	bool packed;				// Whether the input fits in packedB; if not, B itself is compared
+	PackedSubset packedB;
 	
+	friend std::size_t hash_value(const GInvariantEvaluationTask& task);
 public:
 	// Hack to make GInvariantEvaluationTask work with Graph, which requires vertices to be a bit more substantial...
-	GInvariantEvaluationTask() {}
+	GInvariantEvaluationTask() : fnId(0), packed(true), packedB(0) {}
 	
-	GInvariantEvaluationTask(const GInvariant::ptr& _fn, const Subset& _B) : fn(_fn), B(_B) {}
+	GInvariantEvaluationTask(const GInvariant::ptr& _fn, const Subset& _B) :
+		fn(_fn), B(_B), fnId(_fn->getId()), packed(_B.empty() || *_B.rbegin() < MAX_PACKED_POINTS), packedB(packed ? packSubset(_B) : 0) {}
 	
 	GInvariant::ptr getFn() const { return fn; }
-	Subset getInput() const { return B; }
+	boost::uint64_t getFnId() const { return fnId; }
+	const Subset& getInput() const { return B; }
 	
 	unsigned long operator()() const { return fn->evaluate(B); }
 	
 	std::deque<GInvariantEvaluationTask> getDependents() const { return fn->getDependents(B); }
 	Task<unsigned long> package() const { return Task<unsigned long>(*this); }
 	
-	bool operator==(const GInvariantEvaluationTask& rhs) const { return fn->equals(*(rhs.fn)) && B == rhs.B; }
+	bool operator==(const GInvariantEvaluationTask& rhs) const {
+		return fnId == rhs.fnId && packed == rhs.packed && (packed ? packedB == rhs.packedB : B == rhs.B);
+	}
 	bool operator!=(const GInvariantEvaluationTask& rhs) const { return !(*this == rhs); }
 };
 
@@ -1,61 +1,142 @@
 #include "Cache.h"
+#include "CacheRegistry.h"
 #include "Group.h"
+#include "TaskQueue.h"
 
 #include <algorithm>
+#include <limits>
+#include <stdexcept>
 #include <string>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/mem_fn.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/throw_exception.hpp>
 #include <boost/algorithm/string/join.hpp>
-#include <boost/functional/hash.hpp>
-#include <boost/iterator/indirect_iterator.hpp>
 #include <boost/iterator/zip_iterator.hpp>
 
 #include <permlib/construct/schreier_sims_construction.h>
 
+#ifdef __SIZEOF_INT128__
+typedef unsigned __int128 BurnsideSum;		// Wide enough that the sum over G of up to C(v, k) per element cannot overflow
+inline void addToBurnsideSum(BurnsideSum& sum, BurnsideSum x) { sum += x; }
+#else
+typedef boost::uint64_t BurnsideSum;
+inline void addToBurnsideSum(BurnsideSum& sum, BurnsideSum x) { sum = checkedAdd(sum, x); }
+#endif
+
 /* ********************************************************************************************************** */
-class GroupBurnsideEvaluator {
+/**
+ * Task functor that sums, over a contiguous range of the elements of G, the number of k-subsets fixed by each element,
+ * for each k in [kmin, kmax].  Each task keeps its own accumulators, so that no synchronisation is needed until the
+ * partial sums are added together.
+ */
+class GroupBurnsideSweep {
+	typedef std::vector<const PartitionTable*> PartitionTallies;
+	
 	const Group& G;
+	const PartitionTallies& partitionTallies;		// Indexed by k
+	unsigned int kmin;
+	unsigned int kmax;
+	boost::uint64_t first;
+	boost::uint64_t count;
 public:
-	GroupBurnsideEvaluator(const Group& _G) : G(_G) {}
+	GroupBurnsideSweep(const Group& G_, const PartitionTallies& partitionTallies_, unsigned int kmin_, unsigned int kmax_, boost::uint64_t first_, boost::uint64_t count_) :
+		G(G_), partitionTallies(partitionTallies_), kmin(kmin_), kmax(kmax_), first(first_), count(count_) {}
 	
-	unsigned long operator()(unsigned int k) const {
-		// Partition k and group by number
-		std::set<std::multiset<unsigned int> > partitions = partition(k);
-		std::vector<std::vector<unsigned int> > partitionTallies;
-		for (std::set<std::multiset<unsigned int> >::const_iterator it = partitions.begin(); it != partitions.end(); it++) {
-			std::vector<unsigned int> tally(k);
-			for (unsigned int i = 0; i < k; i++) {
-				tally[i] = it->count(i + 1);
+	std::vector<BurnsideSum> operator()() const {
+		const BinomialTable& binomials = G.getBinomials();
+		std::vector<BurnsideSum> sums(kmax + 1);
+		
+		// Scratch space for the cycle type, allocated once for the whole chunk
+		std::vector<unsigned int> cycleLengths(kmax);
+		std::vector<boost::uint64_t> visited(cycleBitmaskWords(G.getNumPoints()));
+		
+		GroupElementIterator it = G.elementsAt(first);
+		for (boost::uint64_t n = 0; n < count; ++n, ++it) {
+			Permutation g = *it;
+			
+			// Get the number of cycles of each length, but only for cycles of length at most kmax
+			permutationCycleType(g, G.getNumPoints(), kmax, &cycleLengths[0], &visited[0]);
+			
+			for (unsigned int k = kmin; k <= kmax; k++) {
+				const PartitionTable& partitions = *partitionTallies[k];
+				for (std::size_t j = 0; j < partitions.size(); j++) {
+					const unsigned int* tally = partitions.tally(j);
+					// This is the number of fixed k-subsets with this cycle type, which is at most C(v, k), so it can only
+					// overflow if C(v, k) itself does
+					boost::uint64_t intermediate = 1;
+					for (unsigned int i = 0; i < k && intermediate != 0; i++) {
+						// Do binomial coefficients pairwise
+						intermediate = checkedMultiply(intermediate, binomials(cycleLengths[i], tally[i]));
+					}
+					addToBurnsideSum(sums[k], intermediate);
+				}
 			}
-			partitionTallies.push_back(tally);
 		}
 		
-		unsigned long s = 0;
+		return sums;
+	}
+	
+	/**
+	 * Computes the number of orbits of k-subsets for each k in [kmin, kmax], by splitting the elements of G into chunks
+	 * that are swept concurrently on the thread pool.  The returned vector is indexed by k.
+	 *
+	 * This waits on the thread pool, except when it is called from within a task running on the pool, where waiting could
+	 * deadlock: the whole sweep is then run serially on the calling thread instead.
+	 */
+	static std::vector<unsigned long> burnside(const Group& G, unsigned int kmin, unsigned int kmax) {
+		// Partition each k and group by number
+		PartitionTallies partitionTallies(kmax + 1);
+		for (unsigned int k = kmin; k <= kmax; k++) {
+			partitionTallies[k] = &partitionTable(k);
+		}
 		
-		for (GroupElementIterator it = G.elementsBegin(); it != G.elementsEnd(); ++it) {
-			Permutation g = *it;
-			std::vector<Cycle> cycles = permutationCycles(g, G.getNumPoints());
+		ThreadPool& pool = ThreadPool::getInstance();
+		boost::uint64_t order = G.order();
+		std::vector<BurnsideSum> totals(kmax + 1);
+		if (pool.isWorkerThread()) {
+			totals = GroupBurnsideSweep(G, partitionTallies, kmin, kmax, 0, order)();
+		} else {
+			// A few chunks per thread, so that a slow chunk does not hold up the rest
+			boost::uint64_t numChunks = std::min<boost::uint64_t>(order, std::max<std::size_t>(1, pool.numThreads() * 4));
+			boost::uint64_t chunkSize = (order + numChunks - 1) / numChunks;
 			
-			// Get list of cycle lengths, but only for cycles of length at most k
-			std::vector<unsigned int> cycleLengths(k);
-			for (std::vector<Cycle>::const_iterator jt = cycles.begin(); jt != cycles.end(); jt++) {
-				if (jt->size() <= k) cycleLengths[jt->size() - 1]++;
+			std::vector<boost::shared_future<std::vector<BurnsideSum> > > futures;
+			for (boost::uint64_t first = 0; first < order; first += chunkSize) {
+				GroupBurnsideSweep sweep(G, partitionTallies, kmin, kmax, first, std::min(chunkSize, order - first));
+				futures.push_back(pool.schedule(Task<std::vector<BurnsideSum> >(sweep)));
 			}
 			
-			for (std::vector<std::vector<unsigned int> >::const_iterator jt = partitionTallies.begin(); jt != partitionTallies.end(); jt++) {
-				unsigned long intermediate = 1;
-				for (int i = 0; i < k; i++) {
-					// Do binomial coefficients pairwise
-					intermediate *= combinat(cycleLengths[i], (*jt)[i]);
+			for (size_t i = 0; i < futures.size(); i++) {
+				const std::vector<BurnsideSum>& sums = futures[i].get();
+				for (unsigned int k = kmin; k <= kmax; k++) {
+					addToBurnsideSum(totals[k], sums[k]);
 				}
-				s += intermediate;
 			}
 		}
 		
-		return s / G.order();
+		std::vector<unsigned long> result(kmax + 1);
+		for (unsigned int k = kmin; k <= kmax; k++) {
+			BurnsideSum orbits = totals[k] / order;
+			if (orbits > std::numeric_limits<unsigned long>::max()) {
+				boost::throw_exception(std::overflow_error("Number of orbits does not fit in an unsigned long"));
+			}
+			result[k] = static_cast<unsigned long>(orbits);
+		}
+		return result;
+	}
+};
+
+/* ********************************************************************************************************** */
+class GroupBurnsideEvaluator {
+	const Group& G;
+public:
+	GroupBurnsideEvaluator(const Group& _G) : G(_G) {}
+	
+	unsigned long operator()(unsigned int k) const {
+		return GroupBurnsideSweep::burnside(G, k, k)[k];
 	}
 };
 
@@ -91,29 +172,45 @@ public:
 	}
 	
 private:
-	GroupBurnsideCache() {}
+	GroupBurnsideCache() { CacheRegistry::getInstance().add("GroupBurnsideCache", *this); }
 };
 
 /* ********************************************************************************************************** */
 // GroupWeakOrdering methods
 
 bool GroupWeakOrdering::operator()(const Group& lhs, const Group& rhs) const {
+	return lhs.getId() < rhs.getId();
+}
+
+/* ********************************************************************************************************** */
+// GroupRegistry methods
+
+boost::uint64_t GroupRegistry::intern(const PermutationGroup& G) {
 	// PermutationGroup does not implement operator<(), and permlib::bsgs_core does not expose their "group ID"
-	// which their operator==() is based off of, so we have to do this.
-	const PermutationGroup& Gl = lhs.getGroup();
-	const PermutationGroup& Gr = rhs.getGroup();
+	// which their operator==() is based off of, so the base and the images of the SGS are flattened into the key.
+	// The sizes of each are included, so that no two groups flatten to the same key.
+	std::vector<boost::uint64_t> key;
+	key.push_back(G.n);
+	key.push_back(G.B.size());
+	key.insert(key.end(), G.B.begin(), G.B.end());
+	key.push_back(G.S.size());
+	for (PermutationGroup::PERMlist::const_iterator it = G.S.begin(); it != G.S.end(); ++it) {
+		for (unsigned int i = 0; i < G.n; i++) {
+			key.push_back((*it)->at(i));
+		}
+	}
 	
-	if (Gl.B < Gr.B) return true;	// PermutationGroup::B is a std::vector of integral type
-	else {
-		// PermutationGroup::S is a PermutationGroup:PERMlist, which is a std::list of pointers
-		// So we have to dereference everything first to compare the SGSes
-		typedef boost::indirect_iterator<PermutationGroup::PERMlist::const_iterator> ListValueIterator;
-		
-		return std::lexicographical_compare(
-			ListValueIterator(Gl.S.begin()), ListValueIterator(Gl.S.end()),
-			ListValueIterator(Gr.S.begin()), ListValueIterator(Gr.S.end()),
-			PermutationWeakOrdering());
+	boost::mutex::scoped_lock lock(mutex);
+	std::map<std::vector<boost::uint64_t>, boost::uint64_t>::iterator it = ids.lower_bound(key);
+	if (it == ids.end() || it->first != key) {
+		it = ids.insert(it, std::make_pair(key, boost::uint64_t(ids.size() + 1)));
 	}
+	return it->second;
+}
+
+std::size_t GroupRegistry::size() const {
+	boost::mutex::scoped_lock lock(mutex);
+	return ids.size();
 }
 
 /* ********************************************************************************************************** */
@@ -190,7 +287,7 @@ void GroupElementIterator::increment() {
  * @param generators The generators of the group.
  */
 Group::Group(unsigned int _v, const std::list<Cycles>& _generators) :
-	v(_v), generators(_generators), generatorPermutations(), G(_v) {
+	v(_v), generators(_generators), generatorPermutations(), G(_v), binomials(_v), id(0) {
 	// Create the generator Permutations
 	for (std::list<Cycles>::const_iterator it = generators.begin(); it != generators.end(); it++) {
 		// First, we have to convert our generator into a string
@@ -214,11 +311,9 @@ Group::Group(unsigned int _v, const std::list<Cycles>& _generators) :
 	// Construct the PermutationGroup itself
 	permlib::SchreierSimsConstruction<Permutation, Transversal> construction(v);
 	G = construction.construct(generatorPermutations.begin(), generatorPermutations.end());
-}
-
-bool Group::operator==(const Group& rhs) const {
-	// We don't really care about the generators that created the group, we only care about how it is represented.
-	return G == rhs.G;
+	
+	// We don't really care about the generators that created the group, we only care about how it is represented
+	id = GroupRegistry::getInstance().intern(G);
 }
 
 GroupElementIterator Group::elementsBegin() const {
@@ -236,6 +331,24 @@ GroupElementIterator Group::elementsEnd() const {
 	return it;
 }
 
+/**
+ * Returns an iterator pointing to the index-th element of the group, in the order that the elements are visited by
+ * incrementing elementsBegin().  Any index of at least order() gives elementsEnd().
+ */
+GroupElementIterator Group::elementsAt(boost::uint64_t index) const {
+	if (index >= order()) return elementsEnd();
+	
+	GroupElementIterator it = elementsBegin();
+	
+	// The iterator state is a mixed-radix number, where the first transversal is the least significant digit
+	for (size_t i = 0; i < it.state.size() && index > 0; i++) {
+		boost::uint64_t radix = std::distance(it.begins[i], it.ends[i]);
+		std::advance(it.state[i], index % radix);
+		index /= radix;
+	}
+	return it;
+}
+
 /**
  * Computes the number of orbits of k-subsets of X = {1, ..,v}.
  */
@@ -245,13 +358,21 @@ unsigned long Group::burnside(unsigned int k) const {
 	return table.query(k);
 }
 
-std::size_t hash_value(const Group& G) {
-	std::size_t seed = 0;
-	boost::hash_combine(seed, G.getGroup().B);
+/**
+ * Computes the number of orbits of k-subsets of X = {1, .., v} for every k <= kmax in a single concurrent sweep over
+ * the elements of the group, and caches them so that subsequent calls to burnside() do not enumerate the group again.
+ */
+void Group::burnsideAll(unsigned int kmax) const {
+	GroupBurnsideLookupTable& table = GroupBurnsideCache::getInstance().query(*this);
 	
-	// Hash the actual stuff in the SGS, not the pointers to them
-	typedef boost::indirect_iterator<PermutationGroup::PERMlist::const_iterator> Iterator;
-	boost::hash_range(seed, Iterator(G.getGroup().S.begin()), Iterator(G.getGroup().S.end()));
+	bool cached = true;
+	for (unsigned int k = 1; k <= kmax && cached; k++) {
+		cached = table.contains(k);
+	}
+	if (cached) return;
 	
-	return seed;
-}
\ No newline at end of file
+	std::vector<unsigned long> orbitCounts = GroupBurnsideSweep::burnside(*this, 1, kmax);
+	for (unsigned int k = 1; k <= kmax; k++) {
+		table.insert(k, orbitCounts[k]);
+	}
+}
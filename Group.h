@@ -1,8 +1,13 @@
 #include "utils.h"
 
 #include <list>
+#include <map>
+#include <vector>
 
+#include <boost/cstdint.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
 #include <permlib/transversal/orbit_set.h>
 
 #ifndef GROUP_H
@@ -15,6 +20,9 @@ class GroupElementIterator;		// Forward declare for Group
 /**
  * A class representing an permutation group.  Mainly present for convenience, and the fact that
  * the group generation process doesn't keep the original list of generators...
+ *
+ * Each group is given an ID by GroupRegistry when it is constructed, which is shared by every group with the same base
+ * and strong generating set.  Equality, hashing and GroupWeakOrdering all work on the ID, so they take constant time.
  */
 class Group : public boost::enable_shared_from_this<Group> {
 public:
@@ -24,17 +32,21 @@ public:
 	const PermutationGroup& getGroup() const { return G; }
 	
 	unsigned int getNumPoints() const { return v; }
+	boost::uint64_t getId() const { return id; }
+	const BinomialTable& getBinomials() const { return binomials; }
 	boost::uint64_t order() const { return G.order(); }
 	bool isMember(const Permutation& perm) { return G.sifts(perm); }
 	
 	unsigned long burnside(unsigned int k) const;
+	void burnsideAll(unsigned int kmax) const;
 	template<class PDomain, class Action>
 		OrbitSet<Permutation, PDomain> orbit(const PDomain& item, Action action) const;
 
 	GroupElementIterator elementsBegin() const;
 	GroupElementIterator elementsEnd() const;
+	GroupElementIterator elementsAt(boost::uint64_t index) const;
 	
-	bool operator==(const Group& rhs) const;
+	bool operator==(const Group& rhs) const { return id == rhs.id; }
 	bool operator!=(const Group& rhs) const { return !(*this == rhs); }
 private:
 	unsigned int v;
@@ -43,19 +55,55 @@ private:
 	// Built by the constructor
 	std::list<Permutation::ptr> generatorPermutations;
 	PermutationGroup G;
+	BinomialTable binomials;		// Binomial coefficients up to v
+	boost::uint64_t id;				// Interned by GroupRegistry
 };
 
 /**
  * Hash function overload for Group, as required by boost::hash
  */
-std::size_t hash_value(const Group& G);
+inline std::size_t hash_value(const Group& G) { return std::size_t(hashPacked(G.getId())); }
+
+/**
+ * Assigns each distinct Group an ID.  Groups are told apart by their base and strong generating set (as the generators
+ * they were built from are not kept by permlib), which are compared once, when the group is constructed.  IDs start
+ * from 1 and are never reused.
+ *
+ * This is implemented as a "classic singleton", which is guaranteed thread-safe in C++11, but is confined to
+ * single-threaded operation in earlier versions of C++.  It should be thread-safe under C++03 on gcc and clang, the two
+ * compilers used in development.
+ */
+class GroupRegistry : public boost::noncopyable {
+public:
+	static GroupRegistry& getInstance() {
+		static GroupRegistry instance;
+		return instance;
+	}
+	
+	/**
+	 * Returns the ID of the group with the given base and strong generating set, assigning it the next ID if it has none
+	 * yet.
+	 */
+	boost::uint64_t intern(const PermutationGroup& G);
+	
+	/**
+	 * Returns the number of IDs assigned so far.
+	 */
+	std::size_t size() const;
+private:
+	GroupRegistry() {}
+	
+	std::map<std::vector<boost::uint64_t>, boost::uint64_t> ids;
+	mutable boost::mutex mutex;
+};
 
 /**
  * This is a weak ordering for Group that will make Group work with containers such as std::map, which
  * requires a weak ordering of keys.  This should not be used as a general-purpose weak ordering, as
  * Groups are not meant to be ordered.
  *
- * This assumes that PermutationGroup's base (B) and strong generating set(S) uniquely describe the PermutationGroup.
+ * This orders groups by ID, and so assumes that PermutationGroup's base (B) and strong generating set (S) uniquely
+ * describe the PermutationGroup (see GroupRegistry).
  */
 struct GroupWeakOrdering {
 	bool operator()(const Group& lhs, const Group& rhs) const;
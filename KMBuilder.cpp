@@ -1,30 +1,37 @@
 #include <algorithm>
 #include <iterator>
 
-#include "ExplicitPruner.h"
+#include <boost/timer/timer.hpp>
+
+#include "CacheRegistry.h"
 #include "KMBuilder.h"
-#include "KMStrategy.h"
-#include "MinRepPruner.h"
-#include "SetImagePruner.h"
+#include "TaskQueue.h"
 
-KMBuilder::KMBuilder(const Group& G_, unsigned int k, const std::vector<Subset>& orbitReps_, const boost::any& _prunerData) :
-G(G_.shared_from_this()), orbitReps(orbitReps_), rho(G->burnside(k)), timer(std::cerr, 2) {
+KMBuilder::KMBuilder(const Group& G_, unsigned int k_, const std::vector<Subset>& orbitReps_, const boost::any& _prunerData, const PrunerSelector& selector) :
+G(G_.shared_from_this()), orbitReps(orbitReps_), k(k_), rho(G->burnside(k)), timer(), metrics(k, rho) {
 	if (rho == 1) {
 		std::cerr << "Iteration for k = " << k << " is trivial" << std::endl;
+		metrics.setPruner("trivial");
 		
 		// If this is the case, then we know the following:
 		// * orbitReps == {1, ..., k - 1}, and the new orbitReps should be {1, ..., k}
 		// * A is a 1x1 matrix, whose entry is G->getNumPoints() - k
 		// So, since we basically have everything, we are ready
-		
+
 //		ready = true;
 	} else {
-		// Prepare the pruner
-		boost::shared_ptr<KMStrategy> strategy = boost::shared_ptr<RecyclerStrategy>(new RecyclerStrategy());
-		pruner = boost::shared_ptr<Pruner>(new TablePruner(*G, k, rho, orbitReps, strategy, _prunerData));
-//		pruner = boost::shared_ptr<Pruner>(new ExplicitPruner(*G, k, rho, orbitReps, _prunerData));
-//		pruner = boost::shared_ptr<Pruner>(new MinRepPruner(*G, k, rho, orbitReps, _prunerData));
-//		pruner = boost::shared_ptr<Pruner>(new SetImagePruner(*G, k, rho, orbitReps, _prunerData));
+		// Prepare the pruner - the selector picks whichever one it predicts to be the cheapest
+		boost::timer::cpu_timer phaseTimer;
+		prediction = selector.select(*G, k, rho, orbitReps, _prunerData);
+		metrics.addPhase("select", phaseTimer.elapsed());
+		
+		phaseTimer.start();
+		pruner = selector.createPruner(prediction.type, *G, k, rho, orbitReps, _prunerData);
+		metrics.addPhase("candidateGeneration", phaseTimer.elapsed());
+		
+		metrics.setPruner(prunerName(prediction.type));
+		metrics.setCandidates(pruner->getCandidates().size());
+		std::cerr << "Using " << prunerName(prediction.type) << " for k = " << k << std::endl;
 	}
 }
 
@@ -40,14 +47,22 @@ KMBuilderOutput KMBuilder::build() {
 	if (rho == 1) {
 		// We have the trivial case
 		
-		unsigned int k = *(orbitReps[0].rbegin()) + 2;	// We didn't store k, but we can reconstruct it
 		newReps.push_back(generateX(k));
 		A[0][0] = G->getNumPoints() - k;
 		
-		return KMBuilderOutput(newReps, A);
+		writeMetrics();
+		return KMBuilderOutput(newReps, A, metrics);
 	} else {
+		boost::timer::cpu_timer pruneTimer;
 		pruner->prune();
+		pruneTimer.stop();
+		metrics.addPhase("prune", pruneTimer.elapsed());
+		
+		boost::timer::cpu_timer phaseTimer;
 		newReps = pruner->getNewReps();
+		metrics.addPhase("outputs", phaseTimer.elapsed());
+		
+		phaseTimer.start();
 		
 		// TODO - find a way to generate the KM matrix without this
 		FullCandidateGenerator g(G->getNumPoints(), orbitReps);
@@ -71,7 +86,27 @@ KMBuilderOutput KMBuilder::build() {
 			}
 		}
 		
-		std::cerr << "Iteration for k = " << candidates.front().size() << " complete" << std::endl;
-		return KMBuilderOutput(newReps, A, pruner->getNewData());
+		metrics.addPhase("assembly", phaseTimer.elapsed());
+		
+		// Log the prediction next to the measured times, so that the cost model can be calibrated
+		std::cerr << prunerName(prediction.type) << " for k = " << k << ": predicted " << prediction.seconds << "s, measured "
+			<< boost::timer::format(pruneTimer.elapsed(), 2, "%ws") << " pruning and " << boost::timer::format(phaseTimer.elapsed(), 2, "%ws")
+			<< " assembling" << std::endl;
+		
+		std::cerr << "Iteration for k = " << k << " complete" << std::endl;
+		CacheRegistry::getInstance().report(std::cerr);
+		
+		pruner->addMetrics(metrics);
+		writeMetrics();
+		return KMBuilderOutput(newReps, A, metrics, pruner->getNewData());
 	}
+}
+
+/**
+ * Completes the metrics of this level, and writes them to the metrics stream if there is one.
+ */
+void KMBuilder::writeMetrics() {
+	metrics.finish(timer.elapsed(), ThreadPool::getInstance().numThreads());
+	std::ostream* out = LevelMetrics::getStream();
+	if (out) metrics.write(*out);
 }
\ No newline at end of file
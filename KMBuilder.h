@@ -4,7 +4,9 @@
 #include <boost/timer/timer.hpp>
 
 #include "GInvariant.h"
+#include "LevelMetrics.h"
 #include "Pruner.h"
+#include "PrunerSelector.h"
 
 #ifndef KMBUILDER_H
 #define KMBUILDER_H
@@ -24,21 +26,26 @@ typedef boost::multi_array<int, 2> Matrix;
  */
 class KMBuilder {
 public:
-	KMBuilder(const Group& G, unsigned int k, const std::vector<Subset>& orbitReps, const boost::any& prunerData = boost::any());
+	KMBuilder(const Group& G, unsigned int k, const std::vector<Subset>& orbitReps, const boost::any& prunerData = boost::any(), const PrunerSelector& selector = PrunerSelector());
 	
 	KMBuilderOutput build();
 private:
+	void writeMetrics();
+	
 	boost::shared_ptr<const Group> G;
 	std::vector<Subset> orbitReps;		// Labels for each row of A
 	
 	// Built by the constructor
+	unsigned int k;
 	unsigned long rho;					// Number of orbits of k-subsets
 	
 	// Depending on whether rho == 1, we may need a pruner
 	boost::shared_ptr<Pruner> pruner;
+	PrunerPrediction prediction;		// The pruner chosen by the selector, and how long it should take
 	
-	// Time each iteration through this
-	boost::timer::auto_cpu_timer timer;
+	// Time each iteration through this, and report it through metrics
+	boost::timer::cpu_timer timer;
+	LevelMetrics metrics;
 };
 
 /**
@@ -50,7 +57,8 @@ private:
 class KMBuilderOutput {
 	friend class KMBuilder;				// Only KMBuilder may build it
 	
-	KMBuilderOutput(const std::vector<Subset>& newReps_, const Matrix& A_, const boost::any& _prunerData = boost::any()) : newReps(newReps_), A(A_), prunerData(_prunerData) {}
+	KMBuilderOutput(const std::vector<Subset>& newReps_, const Matrix& A_, const LevelMetrics& metrics_, const boost::any& _prunerData = boost::any()) :
+		newReps(newReps_), A(A_), metrics(metrics_), prunerData(_prunerData) {}
 public:
 	// Explicit assignment operator - needed due to the assignment semantics of A
 	KMBuilderOutput& operator=(const KMBuilderOutput& other) {
@@ -58,15 +66,18 @@ public:
 		newReps = other.newReps;
 		A.resize(boost::extents[other.A.shape()[0]][other.A.shape()[1]]);	// Resize A before assign
 		A = other.A;
+		metrics = other.metrics;
 		return *this;
 	}
 	
 	std::vector<Subset> getNewReps() const { return newReps; }
 	Matrix getNewMatrix() const { return A; }
+	const LevelMetrics& getMetrics() const { return metrics; }
 	boost::any getPrunerData() const { return prunerData; }
 private:
 	std::vector<Subset> newReps;
 	Matrix A;
+	LevelMetrics metrics;
 	boost::any prunerData;
 };
 #endif
\ No newline at end of file
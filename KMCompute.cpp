@@ -52,14 +52,26 @@ Matrix matrixMultiply(const Matrix& A, const Matrix& B) {
  * Compute the Kramer-Mesner matrix.
  *
  * Precondition: t < k
+ *
+ * @param selector Chooses the pruner used for each level.  By default, this picks the pruner with the lowest
+ *                 predicted cost.
+ * @param metrics If not null, the metrics of each level (from 2-subsets to k-subsets) are appended to it.
  */
-KramerMesnerMatrix computeKMMatrix(const Group& G, unsigned int t, unsigned int k) {
+KramerMesnerMatrix computeKMMatrix(const Group& G, unsigned int t, unsigned int k, const PrunerSelector& selector, std::vector<LevelMetrics>* metrics) {
 	std::vector<KMBuilderOutput> builderOutputs;			// stores the relevant data for k = 2 onwards
 	Matrix A;
 	
+	// Every level needs the number of orbits of its subsets, so count them all in one pass over the group
+	G.burnsideAll(k);
+	
 	for (int i = 2; i <= k; i++) {
 		boost::scoped_ptr<KMBuilder> builder;
 		
+		// Level i looks back no further than (i - 2)-subsets, through the Taxonomy2 and functions of the previous level's
+		// discriminator, so the cached results for anything smaller are retired before it starts
+		Discriminator::retireBelow(i - 2);
+		EvaluationCacheBudget::getInstance().retireBelow(i - 2);
+		
 		// Get orbit representatives of (i - 1)-subsets
 		std::vector<Subset> orbitReps;
 		if (i == 2) {
@@ -79,17 +91,18 @@ KramerMesnerMatrix computeKMMatrix(const Group& G, unsigned int t, unsigned int
 				}
 			}
 			
-			builder.reset(new KMBuilder(G, i, orbitReps));
+			builder.reset(new KMBuilder(G, i, orbitReps, boost::any(), selector));
 		} else {
 			// We get them from what we computed earlier
 			KMBuilderOutput& input = builderOutputs[i - 3];
 			orbitReps = input.getNewReps();
 			
-			builder.reset(new KMBuilder(G, i, orbitReps, input.getPrunerData()));
+			builder.reset(new KMBuilder(G, i, orbitReps, input.getPrunerData(), selector));
 		}
 		
 		KMBuilderOutput builderOutput = builder->build();
 		builderOutputs.push_back(builderOutput);
+		if (metrics) metrics->push_back(builderOutput.getMetrics());
 		
 		// From the identity that A[t][k] = A[t][s] * A[s][k] / combinat(k - t, k - s) for any s
 		// between t and k, we get the following:
@@ -97,7 +110,7 @@ KramerMesnerMatrix computeKMMatrix(const Group& G, unsigned int t, unsigned int
 			assignMatrix(A, builderOutput.getNewMatrix());
 		} else if (i > t + 1) {
 			assignMatrix(A, matrixMultiply(A, builderOutput.getNewMatrix()));
-			scalarDivide(i - t, A);
+			scalarDivide(i - t, A);		// s = i - 1, so combinat(i - t, i - s) = i - t
 		}
 	}
 	
@@ -1,3 +1,5 @@
+#include <vector>
+
 #include <boost/multi_array.hpp>
 
 #ifndef KMCOMPUTE_H
@@ -5,9 +7,11 @@
 
 #include "Group.h"
 #include "KramerMesnerMatrix.h"
+#include "LevelMetrics.h"
+#include "PrunerSelector.h"
 
 typedef boost::multi_array<int, 2> Matrix;
 
-KramerMesnerMatrix computeKMMatrix(const Group& G, unsigned int t, unsigned int k);
+KramerMesnerMatrix computeKMMatrix(const Group& G, unsigned int t, unsigned int k, const PrunerSelector& selector = PrunerSelector(), std::vector<LevelMetrics>* metrics = 0);
 
 #endif
\ No newline at end of file
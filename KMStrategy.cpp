@@ -1,10 +1,233 @@
+#include <algorithm>
+#include <stdexcept>
 #include <vector>
 
+#include <boost/make_shared.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/throw_exception.hpp>
 
 #include "AnchorSet.h"
 #include "Discriminator.h"
 #include "KMStrategy.h"
+#include "Taxonomy1.h"
+
+/* *************************************************************************************************************************
+ * GInvariantSelector
+ ************************************************************************************************************************ */
+const unsigned int GInvariantSelector::TAXONOMY1;
+
+std::vector<unsigned int> GInvariantSelector::kinds(const Group& G) {
+	// By Livingstone-Wagner, a group that is h-homogeneous with h <= v/2 is also (h - 1)-homogeneous, so the sizes of
+	// anchor set that cannot tell subsets apart are exactly 1, .., h
+	unsigned int homogeneity = 0;
+	while (homogeneity < G.getNumPoints() / 2 && G.burnside(homogeneity + 1) == 1) homogeneity++;
+	
+	std::vector<unsigned int> result;
+	for (unsigned int size = G.getNumPoints() / 2; size >= 2 && size > homogeneity; size /= 2) {
+		result.push_back(size);
+	}
+	if (G.order() > 1) result.push_back(TAXONOMY1);
+	return result;
+}
+
+double GInvariantSelector::predictCost(const Group& G, unsigned int kind, std::size_t numCandidates) {
+	double order = double(G.order());
+	
+	// An anchor set has at most one image per element of G, and the orbit of a partition at most one partition per
+	// element, of a couple of blocks for a typical element
+	if (kind != TAXONOMY1) return order * kind + double(numCandidates) * order;
+	return order * G.getNumPoints() + double(numCandidates) * order * 2;
+}
+
+double GInvariantSelector::measureCost(const GInvariant& fn, std::size_t numCandidates) {
+	const Group& G = fn.getGroup();
+	double order = double(G.order());
+	
+	if (const AnchorSet* anchorSet = dynamic_cast<const AnchorSet*>(&fn)) {
+		return order * anchorSet->getAnchorSet().size() + double(numCandidates) * anchorSet->numImages();
+	}
+	if (const Taxonomy1* taxonomy1 = dynamic_cast<const Taxonomy1*>(&fn)) {
+		return order * G.getNumPoints() + double(numCandidates) * taxonomy1->numOrbitBlocks();
+	}
+	return predictCost(G, TAXONOMY1, numCandidates);
+}
+
+unsigned int GInvariantSelector::choose(const Group& G, unsigned int k_) {
+	std::vector<unsigned int> candidates = kinds(G);
+	if (candidates.empty()) return G.getNumPoints() / 2;
+	
+	boost::mutex::scoped_lock lock(mutex);
+	moveTo(k_);
+	
+	std::vector<unsigned int> available;
+	for (std::vector<unsigned int>::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+		if (excluded.count(*it) == 0) available.push_back(*it);
+	}
+	if (!available.empty()) candidates.swap(available);
+	
+	double totalGain = 0, totalCount = 0;
+	for (std::map<unsigned int, Measurement>::const_iterator it = measurements.begin(); it != measurements.end(); ++it) {
+		totalGain += it->second.gain;
+		totalCount += it->second.count;
+	}
+	if (totalCount == 0) return candidates.front();
+	double averageGain = totalGain / totalCount;
+	
+	unsigned int best = candidates.front();
+	double bestRate = -1;
+	for (std::vector<unsigned int>::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+		std::map<unsigned int, Measurement>::const_iterator m = measurements.find(*it);
+		double rate;
+		if (m != measurements.end()) {
+			rate = m->second.gain / std::max(m->second.cost, 1.0);
+		} else {
+			rate = averageGain / std::max(predictCost(G, *it, numCandidates), 1.0);
+		}
+		if (rate > bestRate) {
+			best = *it;
+			bestRate = rate;
+		}
+	}
+	return best;
+}
+
+void GInvariantSelector::record(unsigned int kind, unsigned int k_, double gain, double cost, std::size_t numCandidates_) {
+	boost::mutex::scoped_lock lock(mutex);
+	moveTo(k_);
+	
+	Measurement& m = measurements.insert(std::make_pair(kind, Measurement())).first->second;
+	m.gain += gain;
+	m.cost += cost;
+	m.count += 1;
+	numCandidates = numCandidates_;
+}
+
+void GInvariantSelector::exclude(unsigned int kind, unsigned int k_) {
+	boost::mutex::scoped_lock lock(mutex);
+	moveTo(k_);
+	
+	excluded.insert(kind);
+}
+
+/**
+ * Weighs down every measurement, and lets every kind be chosen again, if k is a new level.  The caller must hold the mutex.
+ */
+void GInvariantSelector::moveTo(unsigned int k_) {
+	if (k_ == k) return;
+	
+	for (std::map<unsigned int, Measurement>::iterator it = measurements.begin(); it != measurements.end(); ++it) {
+		it->second.gain *= MATRIXGENERATOR_GINVARIANT_SELECTOR_DECAY;
+		it->second.cost *= MATRIXGENERATOR_GINVARIANT_SELECTOR_DECAY;
+		it->second.count *= MATRIXGENERATOR_GINVARIANT_SELECTOR_DECAY;
+	}
+	excluded.clear();
+	k = k_;
+}
+
+/* *************************************************************************************************************************
+ * RandomGInvariantSource
+ ************************************************************************************************************************ */
+boost::shared_ptr<GInvariant> RandomGInvariantSource::next(const Group& G, unsigned int k, unsigned int kind) {
+	SplitMix64 rng(seed, k, attempts.fetch_add(1, boost::memory_order_relaxed));
+	if (kind != GInvariantSelector::TAXONOMY1) return drawAnchorSet(G, kind, rng);
+	
+	Permutation g = *G.elementsAt(rng.below(G.order()));
+	while (g.isIdentity()) g = *G.elementsAt(rng.below(G.order()));
+	return boost::make_shared<Taxonomy1>(G, g);
+}
+
+void RandomGInvariantSource::exclude(const GInvariant& fn) {
+	const AnchorSet* anchorSet = dynamic_cast<const AnchorSet*>(&fn);
+	if (!anchorSet) return;
+	
+	Subset form = AnchorSet::canonicalForm(fn.getGroup(), anchorSet->getAnchorSet());
+	boost::mutex::scoped_lock lock(mutex);
+	orbits.insert(form);
+}
+
+/**
+ * Builds an anchor set from an orbit that has not been used yet, preferring long orbits (small stabilizers), or returns
+ * a null pointer if every orbit drawn had been used already.  Each orbit is reserved as soon as it is drawn, so that no
+ * two threads build from the same one, and released again if it is not the one built.
+ */
+AnchorSet::ptr RandomGInvariantSource::drawAnchorSet(const Group& G, unsigned int size, SplitMix64& rng) {
+	const unsigned int maxDraws = 16 * MATRIXGENERATOR_ANCHORSET_CANDIDATES;
+	
+	Subset best, bestForm;
+	boost::uint64_t bestLength = 0;			// Zero until an anchor set from a new orbit is found
+	unsigned int candidates = 0;
+	for (unsigned int draw = 0; draw < maxDraws && candidates < MATRIXGENERATOR_ANCHORSET_CANDIDATES; draw++) {
+		Subset anchorSet = AnchorSet::drawAnchorSet(G, size, rng);
+		Subset form = AnchorSet::canonicalForm(G, anchorSet);
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			if (!orbits.insert(form).second) continue;
+		}
+		candidates++;
+		
+		// Without packed subsets, the orbit is not worth walking, so the first anchor set from a new orbit is taken
+		boost::uint64_t length = (G.getNumPoints() <= MAX_PACKED_POINTS) ? AnchorSet::orbitLength(G, anchorSet) : G.order();
+		if (length <= bestLength) {
+			boost::mutex::scoped_lock lock(mutex);
+			orbits.erase(form);
+			continue;
+		}
+		if (bestLength != 0) {
+			boost::mutex::scoped_lock lock(mutex);
+			orbits.erase(bestForm);
+		}
+		best = anchorSet;
+		bestForm = form;
+		bestLength = length;
+		if (bestLength == G.order()) break;		// It cannot get any longer
+	}
+	
+	if (bestLength == 0) return AnchorSet::ptr();
+	return AnchorSet::buildAnchorSet(G, best);
+}
+
+/* *************************************************************************************************************************
+ * AdaptiveKMStrategy
+ ************************************************************************************************************************ */
+AdaptiveKMStrategy::AdaptiveKMStrategy(boost::uint64_t seed, const boost::shared_ptr<GInvariantSelector>& _selector) :
+	source(seed), selector(_selector), created() {}
+
+boost::shared_ptr<GInvariant> AdaptiveKMStrategy::createNewGInvariant(const Group& G, unsigned int k) {
+	unsigned int kind = selector->choose(G, k);
+	boost::shared_ptr<GInvariant> fn = source.next(G, k, kind);
+	for (std::size_t attempt = 0; !fn && attempt < GInvariantSelector::kinds(G).size(); attempt++) {
+		// The orbits of anchor sets of that size seem to be used up, so the selector is to choose from the other kinds
+		selector->exclude(kind, k);
+		kind = selector->choose(G, k);
+		fn = source.next(G, k, kind);
+	}
+	if (!fn) boost::throw_exception(std::runtime_error("No unused orbit of anchor sets left to draw from"));
+	
+	boost::mutex::scoped_lock lock(mutex);
+	created[fn->getId()] = kind;
+	return fn;
+}
+
+void AdaptiveKMStrategy::recordGInvariant(const boost::shared_ptr<GInvariant>& fn, unsigned int k, double gain, std::size_t numCandidates) {
+	unsigned int kind = 0;
+	bool isNew;
+	{
+		boost::mutex::scoped_lock lock(mutex);
+		std::map<boost::uint64_t, unsigned int>::iterator it = created.find(fn->getId());
+		isNew = (it != created.end());
+		if (isNew) {
+			kind = it->second;
+			created.erase(it);
+		}
+	}
+	
+	if (isNew) {
+		selector->record(kind, k, gain, GInvariantSelector::measureCost(*fn, numCandidates), numCandidates);
+	} else {
+		// One of the initial functions, so the new ones should stay out of its orbit
+		source.exclude(*fn);
+	}
+}
 
 /* *************************************************************************************************************************
  * Taxonomy2Strategy
@@ -18,11 +241,6 @@ std::vector<boost::shared_ptr<GInvariant> > Taxonomy2Strategy::createInitialGInv
 	return resultList;
 }
 
-boost::shared_ptr<GInvariant> Taxonomy2Strategy::createNewGInvariant(const Group& G, unsigned int k) {
-	boost::shared_ptr<AnchorSet> newSet = AnchorSet::buildAnchorSet(G, G.getNumPoints() / 2);
-	return newSet;
-}
-
 /* *************************************************************************************************************************
  * RecyclerStrategy
  ************************************************************************************************************************ */
@@ -35,8 +253,3 @@ std::vector<boost::shared_ptr<GInvariant> > RecyclerStrategy::createInitialGInva
 	return resultList;
 }
 
-boost::shared_ptr<GInvariant> RecyclerStrategy::createNewGInvariant(const Group& G, unsigned int k) {
-	boost::shared_ptr<AnchorSet> newSet = AnchorSet::buildAnchorSet(G, G.getNumPoints() / 2);
-	return newSet;
-}
-
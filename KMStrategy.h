@@ -1,12 +1,44 @@
+#include <map>
+#include <set>
+#include <utility>
 #include <vector>
 
+#include <boost/atomic.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include "TablePruner.h"
 
 #ifndef MatrixGenerator_KMStrategy_h
 #define MatrixGenerator_KMStrategy_h
 
+/* The default seed of the random AnchorSets (and Taxonomy1s) that the strategies resort to.  Together with k and the
+ * number of earlier attempts at the same level, it determines each function, so a run can be replayed exactly by reusing
+ * its seed.
+ */
+#ifndef MATRIXGENERATOR_ANCHORSET_SEED
+#define MATRIXGENERATOR_ANCHORSET_SEED 0x5eed5eed5eed5eedULL
+#endif
+
+/* The number of anchor sets from orbits not yet used that a RandomGInvariantSource compares by the length of their
+ * orbits, before it builds one.  Walking an orbit costs about as much as building an anchor set with a trivial
+ * stabilizer, so this is kept small.
+ */
+#ifndef MATRIXGENERATOR_ANCHORSET_CANDIDATES
+#define MATRIXGENERATOR_ANCHORSET_CANDIDATES 2
+#endif
+
+/* The weight that a GInvariantSelector keeps giving its measurements of earlier levels, each time it moves on to a new
+ * level.
+ */
+#ifndef MATRIXGENERATOR_GINVARIANT_SELECTOR_DECAY
+#define MATRIXGENERATOR_GINVARIANT_SELECTOR_DECAY 0.5
+#endif
+
+class AnchorSet;
 class GInvariant;
 
 /**
@@ -34,24 +66,150 @@ struct KMStrategy {
 	 * isDiscriminator<GInvariantType>::value == false and isTrivial<GInvariantType>::value == false
 	 */
 	virtual boost::shared_ptr<GInvariant> createNewGInvariant(const Group& G, unsigned int k) = 0;
+	
+	/**
+	 * Called by the TablePruner once it has evaluated fn over every candidate, with the fraction of the candidates not
+	 * yet told apart that fn told apart (zero if fn was not kept), and the number of candidates.  This does nothing by
+	 * default.
+	 */
+	virtual void recordGInvariant(const boost::shared_ptr<GInvariant>&, unsigned int, double, std::size_t) {}
+};
+
+/**
+ * Learns which kind of new GInvariant gives a TablePruner the most discrimination for its cost: an AnchorSet of size v/2,
+ * v/4, .., or a Taxonomy1.  Each function that a strategy creates is measured by the fraction of the undiscriminated
+ * candidates that it told apart (its gain), and by the number of operations taken to build it and evaluate it over
+ * every candidate, where an operation is the image of a point or an intersection with a block.  Operations rather than
+ * seconds keep the choices of a run the same from one machine (and one load) to the next.
+ *
+ * The selector chooses the kind with the most gain per operation so far.  A kind that has not been tried yet is given
+ * its predicted cost over as many candidates as the latest function, and the average gain of the kinds that have, so it
+ * is only tried if it would do better than the best of them; with nothing measured yet, the largest anchor set is chosen.  Anchor sets no larger than the degree of
+ * homogeneity of G (the largest h with G.burnside(h) == 1) are never chosen, since every such anchor set gives the same
+ * frequency vector for every k-subset.
+ *
+ * One selector is shared by the strategies of every level (see PrunerSelector), so each level starts out with what
+ * worked at the previous ones.  The measurements of earlier levels are weighed down by
+ * MATRIXGENERATOR_GINVARIANT_SELECTOR_DECAY each time a new level is measured.  This is thread-safe.
+ */
+class GInvariantSelector : public boost::noncopyable {
+public:
+	static const unsigned int TAXONOMY1 = 0;		// The kind of Taxonomy1; any other kind is the size of an AnchorSet
+	
+	GInvariantSelector() : measurements(), k(0), numCandidates(0), excluded() {}
+	
+	/**
+	 * Returns the kinds of function that can tell k-subsets apart for G, largest anchor set first.
+	 */
+	static std::vector<unsigned int> kinds(const Group& G);
+	
+	/**
+	 * Returns the predicted number of operations to build a function of the given kind and evaluate it over
+	 * numCandidates subsets.
+	 */
+	static double predictCost(const Group& G, unsigned int kind, std::size_t numCandidates);
+	
+	/**
+	 * Returns the actual number of operations to build fn and evaluate it over numCandidates subsets.
+	 */
+	static double measureCost(const GInvariant& fn, std::size_t numCandidates);
+	
+	unsigned int choose(const Group& G, unsigned int k);
+	void record(unsigned int kind, unsigned int k, double gain, double cost, std::size_t numCandidates);
+	
+	/**
+	 * Keeps the selector from choosing the given kind again at level k, unless every kind has been excluded.
+	 */
+	void exclude(unsigned int kind, unsigned int k);
+private:
+	struct Measurement {
+		double gain;
+		double cost;
+		double count;								// The number of functions measured, weighed down like the rest
+	};
+	
+	std::map<unsigned int, Measurement> measurements;
+	unsigned int k;									// The level of the latest measurement
+	std::size_t numCandidates;						// The number of candidates of the latest measurement
+	std::set<unsigned int> excluded;				// The kinds that have run out of new functions at level k
+	boost::mutex mutex;
+	
+	void moveTo(unsigned int k);
+};
+
+/**
+ * Draws the random GInvariants of a strategy.  The nth function drawn for k-subsets comes from the SplitMix64 sequence
+ * keyed by (seed, k, n), so it does not depend on which thread draws it, or on what was drawn at other levels, and
+ * several functions can be drawn concurrently.
+ *
+ * An anchor set in the same G-orbit as another gives the same function, so the source remembers the canonical form (see
+ * AnchorSet::canonicalForm()) of every anchor set that it has drawn or been told about (see exclude()), and draws
+ * again rather than build an anchor set in one of those orbits.  Of the first
+ * MATRIXGENERATOR_ANCHORSET_CANDIDATES anchor sets from new orbits, it builds the one with the longest orbit.
+ */
+class RandomGInvariantSource : public boost::noncopyable {
+public:
+	explicit RandomGInvariantSource(boost::uint64_t seed_) : seed(seed_), attempts(0), orbits() {}
+	
+	boost::uint64_t getSeed() const { return seed; }
+	
+	/**
+	 * Draws a function of the given kind (see GInvariantSelector): an AnchorSet of that size, or a Taxonomy1 of a random
+	 * element of G other than the identity.  This returns a null pointer if every anchor set drawn was in an orbit that
+	 * had been used already.
+	 */
+	boost::shared_ptr<GInvariant> next(const Group& G, unsigned int k, unsigned int kind);
+	
+	/**
+	 * Keeps the source from drawing an anchor set in the same orbit as fn, if fn is an AnchorSet.
+	 */
+	void exclude(const GInvariant& fn);
+private:
+	boost::uint64_t seed;
+	boost::atomic<boost::uint64_t> attempts;
+	std::set<Subset> orbits;					// The canonical forms of the anchor sets drawn or excluded so far
+	boost::mutex mutex;							// Guards orbits
+	
+	boost::shared_ptr<AnchorSet> drawAnchorSet(const Group& G, unsigned int size, SplitMix64& rng);
+};
+
+/**
+ * Partial implementation of the KMStrategy interface, which creates new GInvariants of whichever kind its
+ * GInvariantSelector chooses, and reports back to the selector how well each of them did.
+ */
+struct AdaptiveKMStrategy : public KMStrategy {
+	AdaptiveKMStrategy(boost::uint64_t seed, const boost::shared_ptr<GInvariantSelector>& selector);
+	
+	boost::shared_ptr<GInvariant> createNewGInvariant(const Group& G, unsigned int k);
+	void recordGInvariant(const boost::shared_ptr<GInvariant>& fn, unsigned int k, double gain, std::size_t numCandidates);
+private:
+	RandomGInvariantSource source;
+	boost::shared_ptr<GInvariantSelector> selector;
+	std::map<boost::uint64_t, unsigned int> created;	// The kind of each new function, by ID
+	boost::mutex mutex;									// Guards created
 };
 
 /**
  * Concrete implementation of the KMStrategy interface, which uses a Taxonomy2 as its only initial candidate, and resorts
- * to random AnchorSets in the event that the Taxonomy2 fails to discriminate.
+ * to random AnchorSets (or Taxonomy1s) in the event that the Taxonomy2 fails to discriminate.
  */
-struct Taxonomy2Strategy : public KMStrategy {
+struct Taxonomy2Strategy : public AdaptiveKMStrategy {
+	explicit Taxonomy2Strategy(boost::uint64_t seed = MATRIXGENERATOR_ANCHORSET_SEED,
+							   const boost::shared_ptr<GInvariantSelector>& selector = boost::make_shared<GInvariantSelector>()) :
+		AdaptiveKMStrategy(seed, selector) {}
+	
 	std::vector<boost::shared_ptr<GInvariant> > createInitialGInvariants(const Group& G, unsigned int k, const TablePrunerData& output);
-	boost::shared_ptr<GInvariant> createNewGInvariant(const Group& G, unsigned int k);
 };
 
 /**
  * Concrete implementation of the KMStrategy interface, which reuses the functions used bo build the Discriminator as its
- * initial candidates, and resorts to random AnchorSets in the event that the list fails to discriminate.  Note that this
- * exclusively uses the size-independent AnchorSet to do all its work.
+ * initial candidates, and resorts to random AnchorSets (or Taxonomy1s) in the event that the list fails to discriminate.
  */
-struct RecyclerStrategy : public KMStrategy {
+struct RecyclerStrategy : public AdaptiveKMStrategy {
+	explicit RecyclerStrategy(boost::uint64_t seed = MATRIXGENERATOR_ANCHORSET_SEED,
+							  const boost::shared_ptr<GInvariantSelector>& selector = boost::make_shared<GInvariantSelector>()) :
+		AdaptiveKMStrategy(seed, selector) {}
+	
 	std::vector<boost::shared_ptr<GInvariant> > createInitialGInvariants(const Group& G, unsigned int k, const TablePrunerData& output);
-	boost::shared_ptr<GInvariant> createNewGInvariant(const Group& G, unsigned int k);
 };
 #endif
@@ -0,0 +1,93 @@
+#include <map>
+
+#include <sys/resource.h>
+
+#include "LevelMetrics.h"
+
+std::ostream* LevelMetrics::stream = 0;
+
+/**
+ * Writes s as a JSON string.  The names written here are class and phase names, so only quotes and backslashes need
+ * escaping.
+ */
+inline void writeString(std::ostream& out, const std::string& s) {
+	out << '"';
+	for (std::string::const_iterator it = s.begin(); it != s.end(); ++it) {
+		if (*it == '"' || *it == '\\') out << '\\';
+		out << *it;
+	}
+	out << '"';
+}
+
+LevelMetrics::LevelMetrics(unsigned int k_, unsigned long rho_) :
+	k(k_), rho(rho_), pruner(), candidates(0), phases(), rows(), wallSeconds(0), cpuSeconds(0), threads(0), peakMemory(0) {}
+
+void LevelMetrics::addPhase(const std::string& name, double seconds) {
+	for (std::vector<std::pair<std::string, double> >::iterator it = phases.begin(); it != phases.end(); ++it) {
+		if (it->first == name) {
+			it->second += seconds;
+			return;
+		}
+	}
+	phases.push_back(std::make_pair(name, seconds));
+}
+
+void LevelMetrics::addPhase(const std::string& name, const boost::timer::cpu_times& elapsed) {
+	addPhase(name, seconds(elapsed));
+}
+
+void LevelMetrics::finish(const boost::timer::cpu_times& elapsed, std::size_t threads_) {
+	wallSeconds = seconds(elapsed);
+	cpuSeconds = (elapsed.user + elapsed.system) / 1e9;
+	threads = threads_;
+	
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		peakMemory = usage.ru_maxrss;				// Already in bytes
+#else
+		peakMemory = usage.ru_maxrss * 1024L;		// In kilobytes
+#endif
+	}
+}
+
+void LevelMetrics::write(std::ostream& out) const {
+	out << "{\"k\":" << k << ",\"rho\":" << rho << ",\"pruner\":";
+	writeString(out, pruner);
+	out << ",\"candidates\":" << candidates;
+	
+	// Functions tried and kept, by type
+	std::map<std::string, std::pair<unsigned int, unsigned int> > invariants;
+	for (std::vector<Row>::const_iterator it = rows.begin(); it != rows.end(); ++it) {
+		std::pair<unsigned int, unsigned int>& counts = invariants[it->type];
+		counts.first++;
+		if (it->kept) counts.second++;
+	}
+	out << ",\"invariants\":{";
+	typedef std::map<std::string, std::pair<unsigned int, unsigned int> >::const_iterator InvariantIterator;
+	for (InvariantIterator it = invariants.begin(); it != invariants.end(); ++it) {
+		if (it != invariants.begin()) out << ",";
+		writeString(out, it->first);
+		out << ":{\"tried\":" << it->second.first << ",\"kept\":" << it->second.second << "}";
+	}
+	
+	out << "},\"rows\":[";
+	for (std::vector<Row>::const_iterator it = rows.begin(); it != rows.end(); ++it) {
+		if (it != rows.begin()) out << ",";
+		out << "{\"type\":";
+		writeString(out, it->type);
+		out << ",\"seconds\":" << it->seconds << ",\"distinctColumns\":" << it->distinctColumns;
+		out << ",\"kept\":" << (it->kept ? "true" : "false") << "}";
+	}
+	
+	out << "],\"phases\":{";
+	for (std::vector<std::pair<std::string, double> >::const_iterator it = phases.begin(); it != phases.end(); ++it) {
+		if (it != phases.begin()) out << ",";
+		writeString(out, it->first);
+		out << ":" << it->second;
+	}
+	
+	double utilization = (wallSeconds > 0 && threads > 0) ? cpuSeconds / (wallSeconds * threads) : 0;
+	out << "},\"wallSeconds\":" << wallSeconds << ",\"cpuSeconds\":" << cpuSeconds << ",\"threads\":" << threads;
+	out << ",\"threadUtilization\":" << utilization << ",\"peakMemoryBytes\":" << peakMemory << "}" << std::endl;
+}
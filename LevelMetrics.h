@@ -0,0 +1,84 @@
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/timer/timer.hpp>
+
+#ifndef LEVELMETRICS_H
+#define LEVELMETRICS_H
+
+/**
+ * Performance metrics for one level of the Kramer-Mesner matrix construction (ie. one KMBuilder), written as a single
+ * line of JSON so that runs can be compared across versions and groups.
+ *
+ * KMBuilder records the phases it goes through, and the pruner adds whatever it knows about its own work (see
+ * Pruner::addMetrics()).  Times are wall-clock seconds.
+ */
+class LevelMetrics {
+public:
+	/**
+	 * One G-invariant function added to the table of a TablePruner.
+	 */
+	struct Row {
+		std::string type;					// Demangled class name of the function
+		double seconds;						// Time to evaluate the function over every candidate
+		std::size_t distinctColumns;		// Number of distinct columns in the table once the function was added
+		bool kept;							// Whether the function ended up in the discriminator
+	};
+	
+	LevelMetrics(unsigned int k, unsigned long rho);
+	
+	void setPruner(const std::string& name) { pruner = name; }
+	void setCandidates(std::size_t n) { candidates = n; }
+	std::size_t getCandidates() const { return candidates; }
+	
+	/**
+	 * Adds the time spent in the named phase.  Phases are reported in the order they were first added; adding the same
+	 * phase again accumulates its time.
+	 */
+	void addPhase(const std::string& name, double seconds);
+	void addPhase(const std::string& name, const boost::timer::cpu_times& elapsed);
+	
+	void addRow(const Row& row) { rows.push_back(row); }
+	
+	/**
+	 * Records the totals for the level, along with the peak memory use of the process so far.
+	 *
+	 * @param elapsed The wall-clock and CPU time taken by the whole level.
+	 * @param threads The number of threads that were available to the level.
+	 */
+	void finish(const boost::timer::cpu_times& elapsed, std::size_t threads);
+	
+	/**
+	 * Writes the metrics as one line of JSON.
+	 */
+	void write(std::ostream& out) const;
+	
+	/**
+	 * The stream that KMBuilder writes the metrics of each level to, or null (the default) if metrics are not written at
+	 * all.  main() sets it when asked to on the command line.
+	 */
+	static std::ostream* getStream() { return stream; }
+	static void setStream(std::ostream& out) { stream = &out; }
+	
+	static double seconds(const boost::timer::cpu_times& elapsed) { return elapsed.wall / 1e9; }
+private:
+	unsigned int k;
+	unsigned long rho;
+	std::string pruner;
+	std::size_t candidates;
+	
+	std::vector<std::pair<std::string, double> > phases;
+	std::vector<Row> rows;
+	
+	// Set by finish()
+	double wallSeconds;
+	double cpuSeconds;
+	std::size_t threads;
+	long peakMemory;						// Bytes
+	
+	static std::ostream* stream;
+};
+
+#endif
@@ -1,4 +1,12 @@
+#include <map>
+
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+
 #include "Cache.h"
+#include "GInvariant.h"
 #include "utils.h"
 
 #ifndef LookupTable_h
@@ -12,35 +20,85 @@
  * * Evaluators must export a type, FrequencyVector.  This is the value returned from the functor's operator()().
  * * operator()() takes one argument of type const Subset&.  This is the input subset which is to be evaluated upon.
  * * Evaluators must be copyable.
+ * * Evaluators used with a SubsetLookupTable must also have isPacked().  If it returns true, operator()() takes a
+ *   PackedSubset instead.
+ * * Evaluators that own memory (rather than refer to that of their GInvariant) should overload approximateMemoryUsage(),
+ *   so that the copy in each lookup table is counted by the cache memory estimates.
+ */
+
+/**
+ * Translation table, which translates FrequencyVectors into consecutive integers starting from 0, in the order in which
+ * they are first seen.  Each lookup table has its own translation table, and only uses it while holding its write lock,
+ * so the translation table is not locked itself.  Results computed outside of a lookup table (as by
+ * BoundGInvariant::evaluateBatch()) are translated as they are placed in it, by a PrecomputedTranslation.
+ */
+template <class FrequencyVector>
+class Translator : public boost::noncopyable {
+	typedef std::map<FrequencyVector, unsigned long> TranslatorTable;
+public:
+	typedef FrequencyVector frequency_vector_type;
+	
+	Translator() : translator(), nextIdx(0) {}
+	
+	unsigned long operator()(const FrequencyVector& fv) {
+		// Look up in translation table - if not found, return a new value
+		typename TranslatorTable::iterator it = translator.lower_bound(fv);
+		if (it == translator.end() || translator.key_comp()(fv, it->first)) {
+			it = translator.insert(it, std::make_pair(fv, nextIdx++));
+		}
+		return it->second;
+	}
+	
+	std::size_t memoryUsage() const { return approximateMemoryUsage(translator); }
+private:
+	TranslatorTable translator;
+	unsigned long nextIdx;
+};
+
+/**
+ * Computes a missing value for MapCache::query(key, make) by translating a FrequencyVector that was evaluated ahead of
+ * time, outside of the lookup table.  The translation then happens under the write lock of the lookup table, just like
+ * that of the results the lookup table computes itself.
  */
+template <class Translator>
+class PrecomputedTranslation {
+	Translator& translator;
+	const typename Translator::frequency_vector_type& fv;
+public:
+	PrecomputedTranslation(Translator& translator_, const typename Translator::frequency_vector_type& fv_) : translator(translator_), fv(fv_) {}
+	
+	template <class Key>
+	unsigned long operator()(const Key&) { return translator(fv); }
+};
 
 /**
  * Common cache delegate class for all G-Invariant subclasses, used in the evaluation caches.  It consists of a translation
  * table, which translates the FrequencyVectors returned by the Evaluator into the integers required by
- * GInvariant::evaluate() and its caches.
+ * GInvariant::evaluate() and its caches.  Copies of the delegate share the translation table.
  */
 template <class Evaluator>
 class EvaluationDelegate {
 	typedef typename Evaluator::FrequencyVector FrequencyVector;
 public:
-	explicit EvaluationDelegate(const Evaluator& eval_) : eval(eval_) {}
+	typedef Translator<FrequencyVector> translator_type;
 	
-	unsigned long operator()(const Subset& key) {
-		FrequencyVector fv = eval(key);
-		
-		// Look up in translation table - if not found, return a new value
-		if (translator.count(fv) == 0) {
-			translator[fv] = nextIdx;
-			nextIdx++;
-		}
-		return translator[fv];
+	explicit EvaluationDelegate(const Evaluator& eval_) : eval(eval_), translator(new translator_type()) {}
+	
+	/**
+	 * Evaluates a Subset, or a PackedSubset (for the tables of a SubsetLookupTable).
+	 */
+	template <class Key>
+	unsigned long operator()(const Key& key) {
+		return (*translator)(eval(key));
 	}
+	
+	const Evaluator& getEvaluator() const { return eval; }
+	translator_type& getTranslator() const { return *translator; }
+	
+	std::size_t memoryUsage() const { return approximateMemoryUsage(eval) + translator->memoryUsage(); }
 private:
 	Evaluator eval;
-	
-	// Translation table
-	std::map<FrequencyVector, unsigned long> translator;
-	unsigned long nextIdx;
+	boost::shared_ptr<translator_type> translator;
 };
 
 /**
@@ -54,15 +112,73 @@ struct LookupTable {
 };
 
 /**
- * Delegate for inserting new LookupTable<Evaluator>::type as values in a cache.  Note that LookupTable<Evaluator>::type
- * is not copyable (as it is a MapCache, which isn't copyable), and EvaluationDelegate<Evaluator> is not
- * default-constructible.
+ * Convenience class for a lookup table keyed by packed subsets.
+ *
+ * This is to work around the fact that you can't do a "template typedef" in C++03.
+ */
+template <class Evaluator>
+struct PackedLookupTable {
+	typedef MapCache<boost::unordered_map<PackedSubset, unsigned long, PackedSubsetHash>, EvaluationDelegate<Evaluator> > type;
+};
+
+/**
+ * A lookup table that keys its results by packed subsets if its Evaluator works on them (see Evaluator::isPacked()), and
+ * by Subsets otherwise.  Bound functions can then look up and insert packed subsets directly, with a single hash probe
+ * each, while evaluate() packs its input first.
  */
 template <class Evaluator>
+class SubsetLookupTable : public boost::noncopyable {
+	typedef typename PackedLookupTable<Evaluator>::type PackedTable;
+	typedef typename LookupTable<Evaluator>::type UnpackedTable;
+public:
+	typedef EvaluationDelegate<Evaluator> delegate_type;
+	typedef typename delegate_type::translator_type translator_type;
+	
+	explicit SubsetLookupTable(const delegate_type& delegate) :
+		packed(delegate.getEvaluator().isPacked() ? new PackedTable(delegate) : 0),
+		unpacked(delegate.getEvaluator().isPacked() ? 0 : new UnpackedTable(delegate)) {}
+	
+	bool isPacked() const { return packed; }
+	
+	unsigned long query(const Subset& B) { return packed ? packed->query(packSubset(B)) : unpacked->query(B); }
+	bool contains(const Subset& B) { return packed ? packed->contains(packSubset(B)) : unpacked->contains(B); }
+	
+	/**
+	 * Returns a pointer to the result for a packed subset, or NULL if there is none yet; see MapCache::find().
+	 *
+	 * Precondition: isPacked()
+	 */
+	const unsigned long* find(PackedSubset B) { return packed->find(B); }
+	
+	/**
+	 * Looks up the result for a packed subset, computing it with make(B) if there is none yet; see
+	 * MapCache::query(key, make).
+	 *
+	 * Precondition: isPacked()
+	 */
+	template <class Factory>
+	unsigned long query(PackedSubset B, Factory& make) { return packed->query(B, make); }
+	
+	translator_type& getTranslator() { return packed ? packed->getDelegate().getTranslator() : unpacked->getDelegate().getTranslator(); }
+	
+	std::size_t size() { return packed ? packed->size() : unpacked->size(); }
+	std::size_t memoryUsage() { return packed ? packed->memoryUsage() : unpacked->memoryUsage(); }
+	CacheStatistics statistics() { return packed ? packed->statistics() : unpacked->statistics(); }
+private:
+	boost::scoped_ptr<PackedTable> packed;
+	boost::scoped_ptr<UnpackedTable> unpacked;
+};
+
+/**
+ * Delegate for inserting new lookup tables (by default, LookupTable<Evaluator>::type) as values in a cache.  Note that
+ * LookupTable<Evaluator>::type is not copyable (as it is a MapCache, which isn't copyable), and
+ * EvaluationDelegate<Evaluator> is not default-constructible.
+ */
+template <class Evaluator, class Table = typename LookupTable<Evaluator>::type>
 class EvaluatorInsertDelegate {
 	Evaluator eval;
 	
-	typedef typename LookupTable<Evaluator>::type mapped_type;
+	typedef Table mapped_type;
 public:
 	EvaluatorInsertDelegate(const Evaluator& eval_) : eval(eval_) {}
 	
@@ -71,19 +187,51 @@ public:
 		
 		return boost::shared_ptr<mapped_type>(new mapped_type(delegate_type(eval)));
 	}
+	
+	std::size_t memoryUsage() const { return approximateMemoryUsage(eval); }
 };
 
+template <class Evaluator>
+std::size_t approximateMemoryUsage(const EvaluationDelegate<Evaluator>& delegate) { return delegate.memoryUsage(); }
+
+template <class Evaluator, class Table>
+std::size_t approximateMemoryUsage(const EvaluatorInsertDelegate<Evaluator, Table>& delegate) { return delegate.memoryUsage(); }
+
 /**
  * Convenience class for a cache for GInvariants which work on multiple input sizes.
+ *
+ * @param <Table> The lookup table for each size, which is created from an EvaluationDelegate<Evaluator>.
  */
-template <class Evaluator>
-class SizeIndependentLookupTable : public HeapValueStdMapCache<Subset::size_type, typename LookupTable<Evaluator>::type, EvaluatorInsertDelegate<Evaluator> >::type {
-	typedef typename HeapValueStdMapCache<Subset::size_type, typename LookupTable<Evaluator>::type, EvaluatorInsertDelegate<Evaluator> >::type super_type;
+template <class Evaluator, class Table = typename LookupTable<Evaluator>::type>
+class SizeIndependentLookupTable : public HeapValueStdMapCache<Subset::size_type, Table, EvaluatorInsertDelegate<Evaluator, Table> >::type {
+	typedef typename HeapValueStdMapCache<Subset::size_type, Table, EvaluatorInsertDelegate<Evaluator, Table> >::type super_type;
 public:
 	typedef Subset::size_type key_type;
-	typedef typename LookupTable<Evaluator>::type mapped_type;
+	typedef Table mapped_type;
+	
+	explicit SizeIndependentLookupTable(const Evaluator& eval) : super_type(EvaluatorInsertDelegate<Evaluator, Table>(eval)) {}
+};
+
+/**
+ * Bound function (see GInvariant::bind()) that evaluates straight from a lookup table, such as the subtable of a
+ * SizeIndependentLookupTable for one size of subsets.
+ */
+template <class Table>
+class LookupTableBinding : public BoundGInvariant {
+protected:
+	Table* table;
+public:
+	explicit LookupTableBinding(Table& table_) : table(&table_) {}
 	
-	explicit SizeIndependentLookupTable(const Evaluator& eval) : super_type(EvaluatorInsertDelegate<Evaluator>(eval)) {}
+	unsigned long evaluate(const Subset& B) const { return table->query(B); }
 };
 
+/**
+ * Binds to the lookup table of the given size in a SizeIndependentLookupTable.
+ */
+template <class Evaluator, class Table>
+BoundGInvariant::ptr bindLookupTable(SizeIndependentLookupTable<Evaluator, Table>& cache, Subset::size_type size) {
+	return BoundGInvariant::ptr(new LookupTableBinding<Table>(cache.query(size)));
+}
+
 #endif
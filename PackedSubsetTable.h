@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "utils.h"
+
+#ifndef PACKEDSUBSETTABLE_H
+#define PACKEDSUBSETTABLE_H
+
+/**
+ * An open-addressing hash table from packed subsets to unsigned long, using linear probing in a power-of-two array of
+ * slots.  Each slot stores its key next to its value, so a successful lookup is usually a single cache line.
+ *
+ * The table is not thread-safe for writing.  Once built, it can be read concurrently without locking.
+ *
+ * The empty subset marks empty slots, so it cannot be stored as a key.
+ */
+class PackedSubsetTable {
+	struct Slot {
+		PackedSubset key;
+		unsigned long value;
+	};
+	
+	static const PackedSubset EMPTY = 0;
+public:
+	typedef PackedSubset key_type;
+	typedef unsigned long mapped_type;
+	
+	/**
+	 * Creates an empty table, with room for expectedSize keys before it has to grow.
+	 */
+	explicit PackedSubsetTable(std::size_t expectedSize = 0) : slots(), mask(0), numKeys(0) {
+		reserve(expectedSize);
+	}
+	
+	std::size_t size() const { return numKeys; }
+	bool empty() const { return numKeys == 0; }
+	
+	/**
+	 * Maps key to value, replacing any previous value.
+	 *
+	 * Precondition: key != 0
+	 */
+	void insert(PackedSubset key, unsigned long value) {
+		if (2 * (numKeys + 1) > slots.size()) reserve(numKeys + 1);
+		
+		Slot& slot = slots[probe(key)];
+		if (slot.key == EMPTY) {
+			slot.key = key;
+			numKeys++;
+		}
+		slot.value = value;
+	}
+	
+	/**
+	 * Returns a pointer to the value mapped to key, or NULL if there is none.
+	 */
+	const unsigned long* find(PackedSubset key) const {
+		if (numKeys == 0) return NULL;
+		const Slot& slot = slots[probe(key)];
+		return (slot.key == key) ? &slot.value : NULL;
+	}
+	
+	bool contains(PackedSubset key) const { return find(key) != NULL; }
+	
+	/**
+	 * Writes every (key, value) pair in the table to out, as a std::pair<PackedSubset, unsigned long>, in no particular
+	 * order.
+	 */
+	template <class OutputIterator>
+	OutputIterator copyEntries(OutputIterator out) const {
+		for (typename std::vector<Slot>::const_iterator it = slots.begin(); it != slots.end(); ++it) {
+			if (it->key != EMPTY) *out++ = std::make_pair(it->key, it->value);
+		}
+		return out;
+	}
+	
+	/**
+	 * Hints that key will be looked up shortly, so that its home slot can be loaded ahead of time.  Batched lookups
+	 * should prefetch every key before finding any of them.
+	 */
+	void prefetch(PackedSubset key) const {
+#if defined(__GNUC__) || defined(__clang__)
+		if (numKeys != 0) __builtin_prefetch(&slots[hashPacked(key) & mask]);
+#endif
+	}
+	
+	/**
+	 * Makes room for at least n keys, keeping the load factor at most 1/2.
+	 */
+	void reserve(std::size_t n) {
+		std::size_t capacity = 16;
+		while (capacity < 2 * n) capacity *= 2;
+		if (capacity <= slots.size()) return;
+		
+		std::vector<Slot> old;
+		old.swap(slots);
+		Slot empty = {EMPTY, 0};
+		slots.assign(capacity, empty);
+		mask = capacity - 1;
+		
+		for (std::vector<Slot>::const_iterator it = old.begin(); it != old.end(); ++it) {
+			if (it->key != EMPTY) slots[probe(it->key)] = *it;
+		}
+	}
+	
+	/**
+	 * Exchanges the contents of two tables.  This is the way to move a table that has been built elsewhere into place,
+	 * as tables can be large.
+	 */
+	void swap(PackedSubsetTable& other) {
+		slots.swap(other.slots);
+		std::swap(mask, other.mask);
+		std::swap(numKeys, other.numKeys);
+	}
+	
+	/**
+	 * Returns the number of bytes used by the table's slots.
+	 */
+	std::size_t memoryUsage() const { return slots.capacity() * sizeof(Slot); }
+private:
+	std::vector<Slot> slots;
+	std::size_t mask;			// slots.size() - 1
+	std::size_t numKeys;
+	
+	/**
+	 * Returns the index of the slot that holds key, or of the empty slot where it would be inserted.
+	 */
+	std::size_t probe(PackedSubset key) const {
+		std::size_t i = hashPacked(key) & mask;
+		while (slots[i].key != EMPTY && slots[i].key != key) {
+			i = (i + 1) & mask;
+		}
+		return i;
+	}
+};
+
+inline void swap(PackedSubsetTable& lhs, PackedSubsetTable& rhs) { lhs.swap(rhs); }
+
+#endif
@@ -0,0 +1,106 @@
+#include "PerfectSubsetIndex.h"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+
+/**
+ * Builds the index over every key in table.
+ *
+ * The build is first attempted with one slot per key.  If no displacement can be found for some bucket with any of a
+ * few seeds, the number of slots is increased slightly and the build starts over, so the index is then perfect but no
+ * longer minimal.
+ */
+PerfectSubsetIndex::PerfectSubsetIndex(const PackedSubsetTable& table) : seed(0), displacements(), slots(), numKeys(table.size()) {
+	if (numKeys == 0) return;
+	
+	std::vector<std::pair<PackedSubset, unsigned long> > pairs;
+	pairs.reserve(numKeys);
+	table.copyEntries(std::back_inserter(pairs));
+	
+	std::vector<Slot> entries(numKeys);
+	for (std::size_t i = 0; i < numKeys; i++) {
+		entries[i].key = pairs[i].first;
+		entries[i].value = pairs[i].second;
+	}
+	
+	// Four keys per bucket on average
+	displacements.assign(std::max<std::size_t>(1, numKeys / 4), 0);
+	
+	std::size_t numSlots = numKeys;
+	while (true) {
+		for (int attempt = 0; attempt < 4; attempt++) {
+			seed = hashPacked(seed + 0x9e3779b97f4a7c15ULL);
+			Slot empty = {0, 0};
+			slots.assign(numSlots, empty);
+			if (build(entries)) return;
+		}
+		numSlots += numSlots / 32 + 1;
+	}
+}
+
+/**
+ * Orders buckets by decreasing size, so that the hardest buckets are placed while the table is still empty.
+ */
+struct BucketSizeOrdering {
+	const std::vector<std::vector<std::size_t> >& buckets;
+	
+	explicit BucketSizeOrdering(const std::vector<std::vector<std::size_t> >& buckets_) : buckets(buckets_) {}
+	
+	bool operator()(std::size_t lhs, std::size_t rhs) const { return buckets[lhs].size() > buckets[rhs].size(); }
+};
+
+/**
+ * Attempts to find a displacement for every bucket, using the current seed and number of slots.
+ */
+bool PerfectSubsetIndex::build(const std::vector<Slot>& entries) {
+	const std::size_t numBuckets = displacements.size();
+	const boost::uint32_t maxDisplacement = static_cast<boost::uint32_t>(std::min<boost::uint64_t>(0xffffffffULL, 4 * slots.size() + 1024));
+	
+	std::vector<boost::uint64_t> hashes(entries.size());
+	std::vector<std::vector<std::size_t> > buckets(numBuckets);
+	for (std::size_t i = 0; i < entries.size(); i++) {
+		hashes[i] = hashPacked(entries[i].key ^ seed);
+		buckets[bucketOf(hashes[i])].push_back(i);
+	}
+	
+	std::vector<std::size_t> order(numBuckets);
+	for (std::size_t b = 0; b < numBuckets; b++) order[b] = b;
+	std::stable_sort(order.begin(), order.end(), BucketSizeOrdering(buckets));
+	
+	std::vector<bool> occupied(slots.size());
+	std::vector<std::size_t> candidateSlots;
+	for (std::vector<std::size_t>::const_iterator it = order.begin(); it != order.end(); ++it) {
+		const std::vector<std::size_t>& bucket = buckets[*it];
+		if (bucket.empty()) break;		// Every bucket after this one is empty as well
+		
+		bool placed = false;
+		for (boost::uint32_t d = 0; d < maxDisplacement && !placed; d++) {
+			// The keys of the bucket must land in free slots, and in distinct ones
+			candidateSlots.clear();
+			placed = true;
+			for (std::size_t i = 0; i < bucket.size() && placed; i++) {
+				std::size_t slot = slotOf(hashes[bucket[i]], d);
+				placed = !occupied[slot] && std::find(candidateSlots.begin(), candidateSlots.end(), slot) == candidateSlots.end();
+				candidateSlots.push_back(slot);
+			}
+			
+			if (placed) {
+				displacements[*it] = d;
+				for (std::size_t i = 0; i < bucket.size(); i++) {
+					occupied[candidateSlots[i]] = true;
+					slots[candidateSlots[i]] = entries[bucket[i]];
+				}
+			}
+		}
+		if (!placed) return false;
+	}
+	return true;
+}
+
+void PerfectSubsetIndex::swap(PerfectSubsetIndex& other) {
+	std::swap(seed, other.seed);
+	displacements.swap(other.displacements);
+	slots.swap(other.slots);
+	std::swap(numKeys, other.numKeys);
+}
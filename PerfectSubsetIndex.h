@@ -0,0 +1,98 @@
+#include <vector>
+
+#include <boost/cstdint.hpp>
+
+#include "PackedSubsetTable.h"
+#include "utils.h"
+
+#ifndef PERFECTSUBSETINDEX_H
+#define PERFECTSUBSETINDEX_H
+
+/**
+ * A read-only map from packed subsets to unsigned long, built over a fixed set of keys using a minimal perfect hash
+ * (hash-and-displace).  Every key hashes to a bucket, and every bucket stores a displacement that sends each of its keys
+ * to a distinct slot.  A lookup therefore costs one hash, one displacement load and one slot load, with a single key
+ * comparison to reject subsets that were not among the keys.
+ *
+ * Building the index takes time roughly linear in the number of keys, so it only pays off for tables that are read
+ * many times, such as the starting evaluation cache of a Discriminator.
+ */
+class PerfectSubsetIndex {
+	struct Slot {
+		PackedSubset key;
+		unsigned long value;
+	};
+public:
+	typedef PackedSubset key_type;
+	typedef unsigned long mapped_type;
+	
+	PerfectSubsetIndex() : seed(0), displacements(), slots(), numKeys(0) {}
+	explicit PerfectSubsetIndex(const PackedSubsetTable& table);
+	
+	std::size_t size() const { return numKeys; }
+	bool empty() const { return numKeys == 0; }
+	
+	/**
+	 * Returns a pointer to the value mapped to key, or NULL if there is none.
+	 */
+	const unsigned long* find(PackedSubset key) const {
+		if (numKeys == 0) return NULL;
+		boost::uint64_t h = hashPacked(key ^ seed);
+		const Slot& slot = slots[slotOf(h, displacements[bucketOf(h)])];
+		return (slot.key == key) ? &slot.value : NULL;
+	}
+	
+	bool contains(PackedSubset key) const { return find(key) != NULL; }
+	
+	/**
+	 * Hints that key will be looked up shortly.  Only the displacement can be prefetched, as the slot depends on it.
+	 */
+	void prefetch(PackedSubset key) const {
+#if defined(__GNUC__) || defined(__clang__)
+		if (numKeys != 0) __builtin_prefetch(&displacements[bucketOf(hashPacked(key ^ seed))]);
+#endif
+	}
+	
+	void swap(PerfectSubsetIndex& other);
+	
+	/**
+	 * Returns the number of bytes used by the index.
+	 */
+	std::size_t memoryUsage() const { return displacements.capacity() * sizeof(boost::uint32_t) + slots.capacity() * sizeof(Slot); }
+private:
+	boost::uint64_t seed;
+	std::vector<boost::uint32_t> displacements;		// One per bucket
+	std::vector<Slot> slots;						// As many as there are keys, unless the build had to fall back
+	std::size_t numKeys;
+	
+	bool build(const std::vector<Slot>& entries);
+	
+	std::size_t bucketOf(boost::uint64_t h) const {
+		return static_cast<std::size_t>(((h >> 32) * displacements.size()) >> 32);
+	}
+	
+	std::size_t slotOf(boost::uint64_t h, boost::uint32_t displacement) const {
+		// The low half of the hash is the starting slot, and the (odd) high half is the stride
+		return static_cast<std::size_t>(((h & 0xffffffffULL) + displacement * ((h >> 32) | 1)) % slots.size());
+	}
+};
+
+inline void swap(PerfectSubsetIndex& lhs, PerfectSubsetIndex& rhs) { lhs.swap(rhs); }
+
+/**
+ * Moves the contents of table into index, leaving table empty.
+ */
+inline void moveInto(PackedSubsetTable& table, PackedSubsetTable& index) {
+	index.swap(table);
+	PackedSubsetTable().swap(table);
+}
+
+/**
+ * Builds index over the contents of table, and then empties table.
+ */
+inline void moveInto(PackedSubsetTable& table, PerfectSubsetIndex& index) {
+	PerfectSubsetIndex(table).swap(index);
+	PackedSubsetTable().swap(table);
+}
+
+#endif
@@ -8,6 +8,8 @@
 #ifndef MatrixGenerator_Pruner_h
 #define MatrixGenerator_Pruner_h
 
+class LevelMetrics;
+
 /**
  * CandidateGenerator is the abstract superclass for all classes that create a list of orbit representative candidates
  * for k-subsets from orbit representative candidates for (k-1)-subsets.
@@ -98,6 +100,11 @@ public:
 	 * Precondition: prune() has already been called exactly once.
 	 */
 	virtual size_t getColumn(const Subset& candidate) = 0;
+	
+	/**
+	 * Adds whatever the pruner recorded about its own work to the metrics of its level.  By default, nothing is added.
+	 */
+	virtual void addMetrics(LevelMetrics&) const {}
 protected:
 	/**
 	 * Constructs a new pruner.
@@ -0,0 +1,134 @@
+#include "PrunerSelector.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <typeinfo>
+
+#include <boost/make_shared.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "Discriminator.h"
+#include "ExplicitPruner.h"
+#include "KMStrategy.h"
+#include "MinRepPruner.h"
+#include "SetImagePruner.h"
+#include "TablePruner.h"
+
+const char* prunerName(PrunerType type) {
+	switch (type) {
+		case TABLE_PRUNER:		return "TablePruner";
+		case EXPLICIT_PRUNER:	return "ExplicitPruner";
+		case MINREP_PRUNER:		return "MinRepPruner";
+		case SETIMAGE_PRUNER:	return "SetImagePruner";
+	}
+	return "UnknownPruner";
+}
+
+/**
+ * Counts the candidates the DefaultCandidateGenerator would create from orbitReps, without actually creating them.
+ * Each (k-1)-representative A yields one candidate for every point in X greater than the greatest element of A.
+ */
+size_t countCandidates(size_t v, const std::vector<Subset>& orbitReps) {
+	size_t count = 0;
+	for (std::vector<Subset>::const_iterator it = orbitReps.begin(); it != orbitReps.end(); ++it) {
+		count += v - 1 - *(it->rbegin());
+	}
+	return count;
+}
+
+/* ********************************************************************************************************** */
+PrunerCostModel::PrunerCostModel() :
+	taskOverhead(2000), lookupOverhead(5000), expectedRows(2), packedImageFactor(0.33), lexMinFactor(0.25), setImageFactor(0.6),
+	secondsPerOperation(1e-8), numThreads(std::max(1u, boost::thread::hardware_concurrency())) {}
+
+/* ********************************************************************************************************** */
+PrunerSelector::PrunerSelector(const PrunerCostModel& model_) : model(model_), forced(), anchorSeed(MATRIXGENERATOR_ANCHORSET_SEED),
+	invariantSelector(boost::make_shared<GInvariantSelector>()) {}
+
+PrunerSelector::PrunerSelector(PrunerType forced_, const PrunerCostModel& model_) : model(model_), forced(forced_), anchorSeed(MATRIXGENERATOR_ANCHORSET_SEED),
+	invariantSelector(boost::make_shared<GInvariantSelector>()) {}
+
+/**
+ * Estimates the number of operations the given pruner needs to find the orbit representatives of k-subsets, and then to
+ * find the column of each k-subset that the Kramer-Mesner matrix is assembled from.
+ *
+ * @param orbitReps The orbit representatives of (k-1)-subsets, which the candidates are generated from.
+ * @param prunerData The previous level's pruner data, which a TablePruner recycles the functions of.
+ */
+double PrunerSelector::estimateCost(PrunerType type, const Group& G, unsigned int k, unsigned long rho, const std::vector<Subset>& orbitReps, const boost::any& prunerData) const {
+	const double n = static_cast<double>(G.order());
+	const double v = G.getNumPoints();
+	const double c = static_cast<double>(countCandidates(G.getNumPoints(), orbitReps));
+
+	// The assembly looks up the column of every k-subset made by adding one point to a (k-1)-representative
+	const double columns = static_cast<double>(orbitReps.size()) * (v - k + 1);
+
+	switch (type) {
+		case TABLE_PRUNER: {
+			// Each row evaluates every candidate as a separate task, each of which sweeps over the (at most |G|) images of an
+			// anchor set, packed or point by point.  The new functions are anchor sets of size v/2; a pruner that starts from
+			// the previous level's data recycles its functions instead of building the first one.
+			const double imageCost = (G.getNumPoints() <= MAX_PACKED_POINTS) ? model.packedImageFactor : k;
+			const double builds = (prunerData.type() == typeid(TablePrunerData)) ? model.expectedRows - 1 : model.expectedRows;
+			return model.expectedRows * c * (model.taskOverhead + n * imageCost / model.numThreads)
+				+ builds * n * v / 2 + columns * model.lookupOverhead;
+		}
+		case EXPLICIT_PRUNER:
+			// Each new representative enumerates G for each remaining candidate (on average half of them), and each column
+			// enumerates G for each representative (on average half of them); each element costs v + k point images.
+			return (rho * c / 2 + columns * rho / 2) * n * (v + k);
+		case MINREP_PRUNER:
+			// One lex-min search per candidate, single-threaded, and another per column
+			return (c + columns) * model.lexMinFactor * n * v;
+		case SETIMAGE_PRUNER:
+			// One set image search per remaining candidate for each new representative, and per representative for each
+			// column
+			return (rho * c / 2 + columns * rho / 2) * model.setImageFactor * n * v;
+	}
+	return HUGE_VAL;
+}
+
+/**
+ * Selects the pruner predicted to be the cheapest for k-subsets.  If the selector was forced to a particular type, that
+ * type is always returned, along with its predicted cost.
+ */
+PrunerPrediction PrunerSelector::select(const Group& G, unsigned int k, unsigned long rho, const std::vector<Subset>& orbitReps, const boost::any& prunerData) const {
+	const PrunerType types[] = {TABLE_PRUNER, EXPLICIT_PRUNER, MINREP_PRUNER, SETIMAGE_PRUNER};
+	size_t numCandidates = countCandidates(G.getNumPoints(), orbitReps);
+
+	PrunerPrediction best;
+	best.type = forced ? *forced : TABLE_PRUNER;
+	best.cost = estimateCost(best.type, G, k, rho, orbitReps, prunerData);
+
+	std::cerr << "Predicted pruner costs for k = " << k << " (" << numCandidates << " candidates):";
+	for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); ++i) {
+		double cost = estimateCost(types[i], G, k, rho, orbitReps, prunerData);
+		std::cerr << " " << prunerName(types[i]) << " " << cost * model.secondsPerOperation << "s";
+
+		if (!forced && cost < best.cost) {
+			best.type = types[i];
+			best.cost = cost;
+		}
+	}
+	std::cerr << std::endl;
+
+	best.seconds = best.cost * model.secondsPerOperation;
+	return best;
+}
+
+boost::shared_ptr<Pruner> PrunerSelector::createPruner(PrunerType type, const Group& G, unsigned int k, unsigned long rho, const std::vector<Subset>& orbitReps, const boost::any& prunerData) const {
+	switch (type) {
+		case EXPLICIT_PRUNER:
+			return boost::shared_ptr<Pruner>(new ExplicitPruner(G, k, rho, orbitReps, prunerData));
+		case MINREP_PRUNER:
+			return boost::shared_ptr<Pruner>(new MinRepPruner(G, k, rho, orbitReps, prunerData));
+		case SETIMAGE_PRUNER:
+			return boost::shared_ptr<Pruner>(new SetImagePruner(G, k, rho, orbitReps, prunerData));
+		case TABLE_PRUNER:
+		default: {
+			boost::shared_ptr<KMStrategy> strategy = boost::shared_ptr<RecyclerStrategy>(new RecyclerStrategy(anchorSeed, invariantSelector));
+			return boost::shared_ptr<Pruner>(new TablePruner(G, k, rho, orbitReps, strategy, prunerData));
+		}
+	}
+}
@@ -0,0 +1,89 @@
+#include "Pruner.h"
+
+#include <vector>
+
+#include <boost/any.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/optional.hpp>
+#include <boost/shared_ptr.hpp>
+
+#ifndef MatrixGenerator_PrunerSelector_h
+#define MatrixGenerator_PrunerSelector_h
+
+class GInvariantSelector;
+
+/**
+ * The kinds of Pruner that a PrunerSelector can choose from.
+ */
+enum PrunerType {
+	TABLE_PRUNER,
+	EXPLICIT_PRUNER,
+	MINREP_PRUNER,
+	SETIMAGE_PRUNER
+};
+
+const char* prunerName(PrunerType type);
+
+/**
+ * Coefficients of the cost model used by PrunerSelector.  Costs are measured in abstract "operations", where one
+ * operation is roughly the work of applying one group element to one point.  The defaults were calibrated against
+ * PGammaL(2,32) at k = 5 and 6; the predictions are logged next to the measured times so that they can be recalibrated.
+ */
+struct PrunerCostModel {
+	PrunerCostModel();
+
+	double taskOverhead;		// Cost of packaging and scheduling one evaluation task onto the thread pool
+	double lookupOverhead;		// Cost of looking up the column of one k-subset in a TablePruner's Discriminator
+	double expectedRows;		// Number of GInvariants the TablePruner is expected to add before it discriminates
+	double packedImageFactor;	// Cost of intersecting one packed image of an anchor set with a subset
+	double lexMinFactor;		// Fraction of G a lex-min search visits before it settles on the minimum
+	double setImageFactor;		// Fraction of G a set image search visits before it finds (or rules out) an image
+	double secondsPerOperation;	// Conversion factor from operations to seconds
+	unsigned int numThreads;	// Number of threads the TablePruner evaluates on
+};
+
+/**
+ * The pruner chosen by a PrunerSelector for one level, along with its predicted cost.
+ */
+struct PrunerPrediction {
+	PrunerType type;
+	double cost;				// In operations
+	double seconds;				// cost, converted using PrunerCostModel::secondsPerOperation
+};
+
+/**
+ * A PrunerSelector picks the Pruner that is predicted to be the cheapest for producing the orbit representatives of
+ * k-subsets and the columns of the Kramer-Mesner matrix, based on |G|, v, rho, the number of candidates, and whether a
+ * TablePruner would start from the previous level's data.  Broadly, lex-min search wins for small groups (where the
+ * per-task overhead of the table dominates), while the table approach wins for large groups.
+ *
+ * A selector can also be forced to always choose one type of pruner, bypassing the cost model altogether.
+ */
+class PrunerSelector {
+public:
+	explicit PrunerSelector(const PrunerCostModel& model = PrunerCostModel());
+	explicit PrunerSelector(PrunerType forced, const PrunerCostModel& model = PrunerCostModel());
+
+	const PrunerCostModel& getCostModel() const { return model; }
+
+	/**
+	 * The seed of the random AnchorSets that each TablePruner's strategy resorts to (see
+	 * RandomGInvariantSource::drawAnchorSet()).  Runs with the same seed try the same anchor sets.
+	 */
+	boost::uint64_t getAnchorSeed() const { return anchorSeed; }
+	void setAnchorSeed(boost::uint64_t seed) { anchorSeed = seed; }
+
+	double estimateCost(PrunerType type, const Group& G, unsigned int k, unsigned long rho, const std::vector<Subset>& orbitReps, const boost::any& prunerData) const;
+	PrunerPrediction select(const Group& G, unsigned int k, unsigned long rho, const std::vector<Subset>& orbitReps, const boost::any& prunerData) const;
+
+	boost::shared_ptr<Pruner> createPruner(PrunerType type, const Group& G, unsigned int k, unsigned long rho, const std::vector<Subset>& orbitReps, const boost::any& prunerData) const;
+private:
+	PrunerCostModel model;
+	boost::optional<PrunerType> forced;
+	boost::uint64_t anchorSeed;
+	boost::shared_ptr<GInvariantSelector> invariantSelector;	// Shared by the strategies of every level
+};
+
+size_t countCandidates(size_t v, const std::vector<Subset>& orbitReps);
+
+#endif
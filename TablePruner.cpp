@@ -1,81 +1,23 @@
 #include <algorithm>
 
+#include <boost/core/demangle.hpp>
 #include <boost/mem_fn.hpp>
 #include <boost/throw_exception.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/timer/timer.hpp>
 
-#include "AdjacencyList.h"
+#include "DataflowExecutor.h"
 #include "Discriminator.h"
+#include "EvaluationPlanner.h"
 #include "KMStrategy.h"
 #include "TablePruner.h"
 #include "TaskQueue.h"
 #include "TrivialDiscriminator.h"
 
-/**
- * Quick singleton wrapper for the task queue so we don't have to recreate it repeatedly.
- *
- * Thread-safe only in C++11 and under certain compilers in C++03, including clang and gcc.
- */
-class ThreadPool : public boost::noncopyable {
-	TaskQueue task_queue;
-	
-	ThreadPool() : task_queue() {}
-public:
-	static ThreadPool& getInstance() {
-		static ThreadPool instance;
-		return instance;
-	}
-	
-	template <class Ret>
-	boost::shared_future<Ret> schedule(const Task<Ret>& task) {
-		return task_queue.schedule(task);
-	}
-};
-
-/* *********************************************************************************************** */
-/**
- * Task functor that populates the dependecies for a specific GInvariantEvaluationTask.
- */
-class GraphPopulationTask {
-	Graph<GInvariantEvaluationTask>& G;
-	std::deque<GInvariantEvaluationTask> tasks;
-	
-	GraphPopulationTask(Graph<GInvariantEvaluationTask>& G_, const GInvariantEvaluationTask& startingTask) : G(G_), tasks() {
-		tasks.push_back(startingTask);
-	}
-public:
-	/**
-	 * Adds the task and its dependents to the graph.
-	 */
-	void operator()() {
-		while (!tasks.empty()) {
-			GInvariantEvaluationTask task = tasks.front();
-			tasks.pop_front();
-			
-			// TODO - check to see if the dependents were not previously added
-			G.addVertex(task);
-			std::deque<GInvariantEvaluationTask> dependents = task.getDependents();
-			for (std::deque<GInvariantEvaluationTask>::const_iterator it = dependents.begin(); it != dependents.end(); ++it) {
-				G.addEdge(task, *it);
-				tasks.push_back(*it);
-			}
-		}
-	}
-	
-	static Task<void> create(Graph<GInvariantEvaluationTask>& G, const GInvariantEvaluationTask& startingTask) {
-		typedef boost::packaged_task<void> task_type;
-		typedef boost::shared_ptr<task_type> task_ptr;
-		
-		GraphPopulationTask task(G, startingTask);
-		task_ptr ptr = task_ptr(new task_type(task));
-		return Task<void>(ptr);
-	}
-};
-
 /* *********************************************************************************************** */
 TablePruner::TablePruner(const Group& G, unsigned int _k, unsigned long _rho, const std::vector<Subset>& orbitReps, const boost::shared_ptr<KMStrategy>& _strategy, const boost::any& _prunerData) :
-	Pruner(G, rho, DefaultCandidateGenerator(G.getNumPoints(), orbitReps)), k(_k), rho(_rho), strategy(_strategy) {
+	Pruner(G, _rho, DefaultCandidateGenerator(G.getNumPoints(), orbitReps)), k(_k), rho(_rho), strategy(_strategy), ready(false), distinctColumns(1), rows(), checkSeconds(0) {
 	if (rho == 1) {
 		// The program should never reach here, as we have assumed rho > 1.  But just in case...
 		ready = true;
@@ -92,25 +34,33 @@ TablePruner::TablePruner(const Group& G, unsigned int _k, unsigned long _rho, co
 void TablePruner::addGInvariant(const boost::shared_ptr<GInvariant>& fn) {
 	if (ready) return;	// Do nothing if we already have full discrimination;
 	
+	boost::timer::cpu_timer rowTimer;
 	const std::vector<Subset>& candidates = getCandidates();
 	size_t rowIdx = fns.size();									// Row index of the new function
 	fns.push_back(fn);
 	F.resize(boost::extents[fns.size()][candidates.size()]);	// Add new row to F
-	
+
 #ifdef MATRIXGENERATOR_NO_CONCURRENT_EVALUATE
 	// NON-CONCURRENT EVALUATION
-	for (size_t i = 0; i < candidates.size(); ++i) {
-		F[rowIdx][i] = fn->evaluate(candidates[i]);
+	BoundGInvariant::ptr bound = fn->bind(k);
+	if (G->getNumPoints() <= MAX_PACKED_POINTS && !candidates.empty()) {
+		std::vector<PackedSubset> packed(candidates.size());
+		std::transform(candidates.begin(), candidates.end(), packed.begin(), packSubset);
+		bound->evaluateBatch(&packed[0], packed.size(), &F[rowIdx][0]);
+	} else {
+		for (size_t i = 0; i < candidates.size(); ++i) {
+			F[rowIdx][i] = bound->evaluate(candidates[i]);
+		}
 	}
 #else	// MATRIXGENERATOR_NO_CONCURRENT_EVALUATE not defined
 	// CONCURRENT EVALUATION
 	// Chances are, you can't get one thread for every single evaluation, just because there are too
 	// many evaluations to be done.  So, we have to create a thread pool.
+#ifdef MATRIXGENERATOR_PER_CELL_EVALUATION
 	ThreadPool& task_queue = ThreadPool::getInstance();
 	std::vector<boost::shared_future<unsigned long> > futures;
 	futures.reserve(candidates.size());
 	
-#ifdef MATRIXGENERATOR_NO_DEPENDENCY_GRAPH
 	// Create, package, and enqueue tasks
 	for (std::vector<Subset>::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
 		GInvariantEvaluationTask evalTask(fn, *it);
@@ -119,56 +69,62 @@ void TablePruner::addGInvariant(const boost::shared_ptr<GInvariant>& fn) {
 		task_queue.schedule(task);
 	}
 	std::cerr << candidates.size() << " evaluation tasks created" << std::endl;
-#else
-	// Find and sort dependencies
-	Graph<GInvariantEvaluationTask> dependencyGraph;
-	std::vector<boost::shared_future<void> > graphTaskFutures;
-	graphTaskFutures.reserve(labels.size());
-	for (std::vector<Subset>::const_iterator it = labels.begin(); it != labels.end(); ++it) {
-		GInvariantEvaluationTask evalTask(fn, *it);
-		
-		// Create a GraphPopulationTask for each cell, and push it on the (idling) task execution pool
-		Task<void> task = GraphPopulationTask::create(dependencyGraph, evalTask);
-		boost::shared_future<void> future = task_queue.schedule(task);
-		graphTaskFutures.push_back(future);
-	}
-	boost::wait_for_all(graphTaskFutures.begin(), graphTaskFutures.end());
-	std::list<GInvariantEvaluationTask> sortedTasks = dependencyGraph.topological_sort();
-	
-	// Package and enqueue tasks
-	for (std::list<GInvariantEvaluationTask>::const_iterator it = sortedTasks.begin(); it != sortedTasks.end(); ++it) {
-		if (it->getFn()->equals(*fn)) {
-			// We must package *it and also get its future
-			for (int i = 0; i < labels.size(); ++i) {		// For putting the future in the right place
-				if (labels[i].getLabel() == it->getInput()) {
-					Task<unsigned long> task = it->package();
-					boost::shared_future<unsigned long> future = task.get_future();
-					
-					futures.push_back(future);
-					task_queue.schedule(task);
-					break;
-				}
-			}
-		} else {
-			// We don't need the result of this, so we just package and schedule
-			task_queue.schedule(it->package());
-		}
-	}
-	std::cerr << sortedTasks.size() << " evaluation tasks created" << std::endl;
-#endif	// MATRIXGENERATOR_NO_DEPENDENCY_GRAPH
 	
 	boost::wait_for_all(futures.begin(), futures.end());
 	std::transform(futures.begin(), futures.end(), F[rowIdx].begin(), boost::mem_fn(&boost::shared_future<unsigned long>::get));
+#elif defined(MATRIXGENERATOR_LAYERED_EVALUATION)
+	// Evaluate whatever fn depends on first, one layer at a time, so that every evaluation of fn finds its
+	// dependencies already cached
+	EvaluationPlanner planner(fn, candidates);
+	std::cerr << planner.numTasks() << " evaluation tasks planned in " << planner.numLayers() << " layers" << std::endl;
+	planner.evaluate(F[rowIdx].begin());
+#else
+	// Run each evaluation as soon as everything it depends on has been evaluated
+	DataflowExecutor executor(fn, candidates);
+	std::cerr << executor.numTasks() << " evaluation tasks created" << std::endl;
+	executor.evaluate(F[rowIdx].begin());
+#endif	// MATRIXGENERATOR_PER_CELL_EVALUATION
 #endif	// MATRIXGENERATOR_NO_CONCURRENT_EVALUATE
+
+	LevelMetrics::Row row;
+	row.type = boost::core::demangle(typeid(*fn).name());
+	row.seconds = LevelMetrics::seconds(rowTimer.elapsed());
 	
 	// Now, do we have a discriminator?  We do if and only if the number of distinct columns in F is the same
 	// as rho.  That's what we find out next.
+	boost::timer::cpu_timer checkTimer;
 	std::set<TableColumn> columnSet;
 	for (size_t i = 0; i < candidates.size(); ++i) {
 		columnSet.insert(F[boost::indices[Table::index_range()][i]]);
 	}
+	checkSeconds += LevelMetrics::seconds(checkTimer.elapsed());
 	std::cerr << columnSet.size() << "/" << rho << " orbit representatives found" << std::endl;
-	if (columnSet.size() == rho) ready = true;
+	
+	EvaluationCacheBudget& budget = EvaluationCacheBudget::getInstance();
+	row.distinctColumns = columnSet.size();
+	row.kept = (columnSet.size() > distinctColumns);
+	rows.push_back(row);
+	
+	// Let the strategy know how much fn told apart, and over how many candidates
+	double gain = row.kept ? double(columnSet.size() - distinctColumns) / (rho - distinctColumns) : 0.0;
+	strategy->recordGInvariant(fn, k, gain, candidates.size());
+	
+	if (row.kept) {
+		distinctColumns = columnSet.size();
+		budget.touch(fn);
+	} else {
+		// fn does not tell any more candidates apart, so it is left out of the discriminator.  Its cache is of no further
+		// use, unless it is shared with a function that is kept.
+		fns.pop_back();
+		F.resize(boost::extents[fns.size()][candidates.size()]);
+		
+		bool shared = false;
+		for (std::vector<boost::shared_ptr<GInvariant> >::const_iterator it = fns.begin(); it != fns.end() && !shared; ++it) {
+			shared = (*it)->equals(*fn);
+		}
+		if (!shared) budget.drop(fn);
+	}
+	if (distinctColumns == rho) ready = true;
 }
 
 void TablePruner::prune() {
@@ -219,7 +175,9 @@ void TablePruner::initOutputs() {
 		}
 		
 		std::map<FrequencyVector, unsigned long> lookupTable;
-		std::map<Subset, unsigned long> newCache;
+		bool packed = G->getNumPoints() <= MAX_PACKED_POINTS;
+		PackedSubsetTable newCache(packed ? candidates.size() : 0);
+		std::map<Subset, unsigned long> unpackedCache;		// Takes the place of newCache if the subsets cannot be packed
 		unsigned long nextIdx = 0;
 		for (int i = 0; i < columns.size(); ++i) {
 			FrequencyVector fv = columns[i];
@@ -237,14 +195,35 @@ void TablePruner::initOutputs() {
 			// We also have it that the discriminator, when evaluated at candidates[i], returns lookupTable[fv].
 			// Also, the minimum representative for candidates[i] is at newReps[lookupTable[fv]].
 			unsigned long idx = lookupTable[fv];
-			newCache[candidates[i]] = idx;
+			if (packed) {
+				newCache.insert(packSubset(candidates[i]), idx);
+			} else {
+				unpackedCache.insert(unpackedCache.end(), std::make_pair(candidates[i], idx));
+			}
 			(*candidateMap)[candidates[i]] = idx;
 		}
 		
-		// Build the discriminator and store it in the prunerData
-		boost::shared_ptr<Discriminator> discriminator(new Discriminator(*G, fns, lookupTable, newCache));
+		// Build the discriminator and store it in the prunerData; this moves the starting caches into the discriminator
+		boost::shared_ptr<Discriminator> discriminator(new Discriminator(*G, k, fns, lookupTable, newCache, unpackedCache));
 		newPrunerData = TablePrunerData(discriminator);
+		
+		// No evaluations are running between levels, so this is where the discriminators' caches are frozen.  The
+		// previous discriminator's results were filled in while pruning this level.
+		if (prunerData && !prunerData->isTrivial()) {
+			boost::static_pointer_cast<Discriminator>(prunerData->getDiscriminator())->freeze();
+		}
+		discriminator->freeze();
+		
+		std::size_t cacheBytes = EvaluationCacheBudget::getInstance().trim(fns);
+		std::cerr << "Evaluation caches use " << (cacheBytes >> 20) << " MiB" << std::endl;
+	}
+}
+
+void TablePruner::addMetrics(LevelMetrics& metrics) const {
+	for (std::vector<LevelMetrics::Row>::const_iterator it = rows.begin(); it != rows.end(); ++it) {
+		metrics.addRow(*it);
 	}
+	metrics.addPhase("discriminationCheck", checkSeconds);
 }
 
 std::vector<Subset> TablePruner::getNewReps() {
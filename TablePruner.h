@@ -3,17 +3,22 @@
 #include <boost/optional.hpp>
 #include <boost/multi_array.hpp>
 
+#include "LevelMetrics.h"
+
 #ifndef MatrixGenerator_TablePruner_h
 #define MatrixGenerator_TablePruner_h
 
 class GInvariant;
 class KMStrategy;
 
-/* The following macros suppress the concurrent evaluation of cells in the table, as well as the dependency search
- * if the GInvariant type can spawn dependencies.
+/* The following macros choose how the cells of the table are evaluated.  By default, the cells and their dependencies are
+ * run as a dataflow (see DataflowExecutor).  MATRIXGENERATOR_NO_CONCURRENT_EVALUATE evaluates the cells one at a time on
+ * the calling thread, MATRIXGENERATOR_PER_CELL_EVALUATION makes each cell its own task without scheduling its
+ * dependencies, and MATRIXGENERATOR_LAYERED_EVALUATION runs the dependencies one layer at a time (see EvaluationPlanner).
  */
 //#define MATRIXGENERATOR_NO_CONCURRENT_EVALUATE
-#define MATRIXGENERATOR_NO_DEPENDENCY_GRAPH
+//#define MATRIXGENERATOR_PER_CELL_EVALUATION
+//#define MATRIXGENERATOR_LAYERED_EVALUATION
 
 class TablePrunerData {
 	friend class TablePruner;		// Only TablePruner can create instances
@@ -62,6 +67,8 @@ public:
 	std::vector<Subset> getNewReps();
 	boost::any getNewData();
 	size_t getColumn(const Subset& candidate);			// TODO - need a way to generate KM matrix without it
+	
+	void addMetrics(LevelMetrics& metrics) const;
 private:
 	boost::shared_ptr<KMStrategy> strategy;
 	boost::optional<TablePrunerData> prunerData;
@@ -69,7 +76,12 @@ private:
 	// Scratch material
 	Table F;
 	bool ready;
-	std::vector<boost::shared_ptr<GInvariant> > fns;
+	std::vector<boost::shared_ptr<GInvariant> > fns;	// Only the functions that told candidates apart are kept
+	std::size_t distinctColumns;						// Number of distinct columns in F
+	
+	// Metrics
+	std::vector<LevelMetrics::Row> rows;				// One for every function tried, kept or not
+	double checkSeconds;								// Time spent counting the distinct columns of F
 	
 	unsigned int k;										// TODO - move to common superclass
 	unsigned long rho;									// TODO - move to common superclass
@@ -1,4 +1,7 @@
+#include <iostream>
+
 #include <boost/bind.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/asio/io_service.hpp>
 #include <boost/thread/future.hpp>
 #include <boost/thread/thread.hpp>
@@ -36,6 +39,14 @@ public:
 		io_service.post(task);
 		return task.get_future();
 	}
+	
+	std::size_t size() const { return threads.size(); }
+	
+	/**
+	 * Returns whether the calling thread is one of the worker threads.  A task that waits on other tasks of the same
+	 * queue can deadlock if every worker is waiting, so such code should do the work itself when this returns true.
+	 */
+	bool isWorkerThread() { return threads.is_this_thread_in(); }
 private:
 	boost::asio::io_service io_service;
 	boost::asio::io_service::work work;
@@ -44,4 +55,28 @@ private:
 	void run() { io_service.run(); }
 };
 
+/**
+ * Quick singleton wrapper for the task queue so we don't have to recreate it repeatedly.
+ *
+ * Thread-safe only in C++11 and under certain compilers in C++03, including clang and gcc.
+ */
+class ThreadPool : public boost::noncopyable {
+	TaskQueue task_queue;
+	
+	ThreadPool() : task_queue() {}
+public:
+	static ThreadPool& getInstance() {
+		static ThreadPool instance;
+		return instance;
+	}
+	
+	template <class Ret>
+	boost::shared_future<Ret> schedule(const Task<Ret>& task) {
+		return task_queue.schedule(task);
+	}
+	
+	std::size_t numThreads() const { return task_queue.size(); }
+	bool isWorkerThread() { return task_queue.isWorkerThread(); }
+};
+
 #endif
@@ -1,31 +1,120 @@
 #include <algorithm>
+#include <iterator>
+#include <limits>
 
 #include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/functional/hash.hpp>
 
+#include "CacheRegistry.h"
 #include "LookupTable.h"
 #include "Taxonomy1.h"
 
 class Taxonomy1Evaluator {
-	typedef std::vector<unsigned long> InnerFrequencyVector;
-	
-	const std::set<Partition>& pOrbit;
+	const std::vector<PackedSubset>& pOrbit;
+	const std::vector<Subset>& unpackedOrbit;
+	std::size_t blocksPerPartition;
 public:
-	typedef std::multiset<InnerFrequencyVector> FrequencyVector;
+	// The inner frequency vectors are encoded as fixed-width runs of words, and the multiset of them is stored as the
+	// runs in sorted order, one after the other
+	typedef std::vector<boost::uint64_t> FrequencyVector;
 	
-	Taxonomy1Evaluator(const std::set<Partition>& _pOrbit) : pOrbit(_pOrbit) {}
+	Taxonomy1Evaluator(const std::vector<PackedSubset>& _pOrbit, const std::vector<Subset>& _unpackedOrbit, std::size_t _blocksPerPartition) :
+		pOrbit(_pOrbit), unpackedOrbit(_unpackedOrbit), blocksPerPartition(_blocksPerPartition) {}
 	
 	FrequencyVector operator()(const Subset& B) const {
+		const unsigned int k = B.size();
+		
+		// The inner frequency vector has k + 1 entries, each in [0, blocksPerPartition].  They are the digits of a number
+		// in base blocksPerPartition + 1, which is split over as many words as it takes, so the encoding is always exact.
+		// Almost always one word is enough.
+		const boost::uint64_t radix = blocksPerPartition + 1;
+		unsigned int digitsPerWord = 0;
+		for (boost::uint64_t scale = 1; scale <= std::numeric_limits<boost::uint64_t>::max() / radix; scale *= radix) {
+			digitsPerWord++;
+		}
+		const unsigned int wordsPerVector = (k + digitsPerWord) / digitsPerWord;
+		
 		FrequencyVector result;
-		for (std::set<Partition>::const_iterator it = pOrbit.begin(); it != pOrbit.end(); ++it) {
-			// Construct the inner frequency vector, similar to the Anchor Set approach
-			InnerFrequencyVector fv(B.size() + 1);
-			for (Partition::const_iterator jt = it->begin(); jt != it->end(); ++jt) {
-				fv[setIntersection(*jt, B).size()]++;
+		if (unpackedOrbit.empty()) {
+			const PackedSubset packedB = packSubset(B);
+			result.reserve(pOrbit.size() / blocksPerPartition * wordsPerVector);
+			
+			unsigned int fv[MAX_PACKED_POINTS + 1];		// Inner frequency vector, similar to the Anchor Set approach
+			for (std::vector<PackedSubset>::const_iterator it = pOrbit.begin(); it != pOrbit.end(); it += blocksPerPartition) {
+				std::fill(fv, fv + k + 1, 0);
+				for (std::vector<PackedSubset>::const_iterator jt = it; jt != it + blocksPerPartition; ++jt) {
+					fv[popcount(*jt & packedB)]++;
+				}
+				encode(fv, k, radix, digitsPerWord, result);
 			}
+		} else {
+			result.reserve(unpackedOrbit.size() / blocksPerPartition * wordsPerVector);
 			
-			result.insert(fv);
+			std::vector<unsigned int> fv(k + 1);
+			for (std::vector<Subset>::const_iterator it = unpackedOrbit.begin(); it != unpackedOrbit.end(); it += blocksPerPartition) {
+				std::fill(fv.begin(), fv.end(), 0);
+				for (std::vector<Subset>::const_iterator jt = it; jt != it + blocksPerPartition; ++jt) {
+					fv[intersectionSize(*jt, B)]++;
+				}
+				encode(&fv[0], k, radix, digitsPerWord, result);
+			}
+		}
+		
+		if (wordsPerVector == 1) {
+			std::sort(result.begin(), result.end());
+			return result;
+		}
+		return sortRuns(result, wordsPerVector);
+	}
+private:
+	/**
+	 * Appends the k + 1 entries of fv to codes, digitsPerWord entries per word, most significant entry first.
+	 */
+	static void encode(const unsigned int* fv, unsigned int k, boost::uint64_t radix, unsigned int digitsPerWord, FrequencyVector& codes) {
+		for (unsigned int end = k + 1; end > 0; end -= std::min(end, digitsPerWord)) {
+			boost::uint64_t code = 0;
+			for (unsigned int i = end; i > end - std::min(end, digitsPerWord); i--) {
+				code = code * radix + fv[i - 1];
+			}
+			codes.push_back(code);
+		}
+	}
+	
+	/**
+	 * Sorts codes as consecutive runs of length words each.
+	 */
+	static FrequencyVector sortRuns(const FrequencyVector& codes, unsigned int length) {
+		std::vector<FrequencyVector> runs;
+		runs.reserve(codes.size() / length);
+		for (FrequencyVector::const_iterator it = codes.begin(); it != codes.end(); it += length) {
+			runs.push_back(FrequencyVector(it, it + length));
+		}
+		std::sort(runs.begin(), runs.end());
+		
+		FrequencyVector result;
+		result.reserve(codes.size());
+		for (std::vector<FrequencyVector>::const_iterator it = runs.begin(); it != runs.end(); ++it) {
+			result.insert(result.end(), it->begin(), it->end());
+		}
+		return result;
+	}
+	
+	static std::size_t intersectionSize(const Subset& A, const Subset& B) {
+		std::size_t result = 0;
+		Subset::const_iterator it = A.begin(), jt = B.begin();
+		while (it != A.end() && jt != B.end()) {
+			if (*it < *jt) {
+				++it;
+			} else if (*jt < *it) {
+				++jt;
+			} else {
+				result++;
+				++it;
+				++jt;
+			}
 		}
 		return result;
 	}
@@ -41,38 +130,25 @@ public:
 };
 
 /* ************************************************************************************************** */
-class Taxonomy1EvalCache : public boost::noncopyable, public HeapValueStdMapCache<Taxonomy1, Taxonomy1LookupTable, HeapValueFromKeyInsertDelegate<Taxonomy1LookupTable>, Taxonomy1WeakOrdering>::type {
+/**
+ * Evaluation cache for Taxonomy1::evaluate().  It is keyed by ID, as a copy of a Taxonomy1 holds its whole orbit.
+ */
+class Taxonomy1EvalCache : public boost::noncopyable, public IdKeyedCache<Taxonomy1, Taxonomy1LookupTable> {
 	// boost::noncopyable also implicitly deletes move constructors
-	
+
 public:
 	static Taxonomy1EvalCache& getInstance() {
 		static Taxonomy1EvalCache instance;
 		return instance;
 	}
 private:
-	Taxonomy1EvalCache() {}
+	Taxonomy1EvalCache() { CacheRegistry::getInstance().add("Taxonomy1EvalCache", *this); }
 };
 
 /* ************************************************************************************************** */
 // Taxonomy1WeakOrdering methods
 bool Taxonomy1WeakOrdering::operator()(const Taxonomy1& lhs, const Taxonomy1& rhs) const {
-	if (GroupWeakOrdering()(lhs.getGroup(), rhs.getGroup())) return true;
-	
-	// As Permutation is a wrapper around std::vector (of some integral type), but doesn't actually have
-	// operator<() implemented, we have to reinvent the wheel here.  We can't even use std::lexicographical_compare()
-	// since we don't have iterators either!
-	const Permutation& leftPerm = lhs.getBasePerm();
-	const Permutation& rightPerm = rhs.getBasePerm();
-	
-	int il = 0;
-	int ir = 0;
-	while (il != leftPerm.size()) {
-		if (ir == rightPerm.size() || rightPerm.at(ir) < leftPerm.at(il)) return false;
-		else if (leftPerm.at(il) < rightPerm.at(ir)) return true;
-		il++;
-		ir++;
-	}
-	return ir != rightPerm.size();
+	return lhs.getId() < rhs.getId();
 }
 
 /* ************************************************************************************************** */
@@ -82,53 +158,67 @@ bool Taxonomy1WeakOrdering::operator()(const Taxonomy1& lhs, const Taxonomy1& rh
  * Precondition: basePerm must be a permutation from the group G.
  */
 Taxonomy1::Taxonomy1(const Group& G, const Permutation& _basePerm) :
-GInvariant(G), basePerm(_basePerm), pOrbit() {
+GInvariant(G), basePerm(_basePerm), pOrbit(), unpackedOrbit(), blocksPerPartition(0) {
 	// The subgroup generated by basePerm has a system of orbits that partitions X = {1, .., v}
 	// To get to this partition we simply interpret the disjoint cycle form as a set of subsets.
-	Partition partition;
+	std::vector<Subset> partition;
 	std::vector<Cycle> cycleForm = permutationCycles(basePerm, G.getNumPoints());
 	for (std::vector<Cycle>::const_iterator it = cycleForm.begin(); it != cycleForm.end(); it++) {
-		partition.insert(Subset(it->begin(), it->end()));
+		partition.push_back(Subset(it->begin(), it->end()));
 	}
+	blocksPerPartition = partition.size();
 	
 	// Then generate the orbit of the partition as follows: a Permutation in G acts on the partition
-	// by acting on each Subset individually, so the result is a set of Subsets.
-	for (GroupElementIterator it = G.elementsBegin(); it != G.elementsEnd(); it++) {
-		Permutation g = *it;
+	// by acting on each Subset individually, so the result is a set of Subsets.  Sorting the image blocks gives each
+	// partition a canonical form, so that repeated images can be weeded out.
+	if (G.getNumPoints() <= MAX_PACKED_POINTS) {
+		std::vector<PackedSubset> packedPartition;
+		std::transform(partition.begin(), partition.end(), std::back_inserter(packedPartition), packSubset);
 		
-		Partition image;
-		for (Partition::const_iterator jt = partition.begin(); jt != partition.end(); jt++) {
-			// Apply g to *jt
-			Subset p;
-			std::transform(jt->begin(), jt->end(), std::inserter(p, p.begin()), boost::bind(&Permutation::at, g, _1));
-			image.insert(p);
+		boost::unordered_set<std::vector<PackedSubset> > seen;
+		std::vector<PackedSubset> image(blocksPerPartition);
+		for (GroupElementIterator it = G.elementsBegin(); it != G.elementsEnd(); it++) {
+			Permutation g = *it;
+			
+			for (std::size_t i = 0; i < blocksPerPartition; i++) {
+				image[i] = applyPermutation(g, packedPartition[i]);
+			}
+			std::sort(image.begin(), image.end());
+			
+			if (seen.insert(image).second) {
+				pOrbit.insert(pOrbit.end(), image.begin(), image.end());
+			}
+		}
+	} else {
+		std::set<std::vector<Subset> > seen;
+		std::vector<Subset> image(blocksPerPartition);
+		for (GroupElementIterator it = G.elementsBegin(); it != G.elementsEnd(); it++) {
+			Permutation g = *it;
+			
+			for (std::size_t i = 0; i < blocksPerPartition; i++) {
+				image[i].clear();
+				for (Subset::const_iterator jt = partition[i].begin(); jt != partition[i].end(); ++jt) {
+					image[i].insert(g.at(*jt));
+				}
+			}
+			std::sort(image.begin(), image.end());
+			
+			if (seen.insert(image).second) {
+				unpackedOrbit.insert(unpackedOrbit.end(), image.begin(), image.end());
+			}
 		}
-		
-		pOrbit.insert(image);
 	}
-}
-
-/**
- * Compares Taxonomy1 for equality.
- *
- * Two Taxonomy1 instances over the same group are equal if they are generated by the same element.
- */
-bool Taxonomy1::equals(const GInvariant& rhs) const {
-	if (!GInvariant::equals(rhs)) return false;
-	const Taxonomy1& other = static_cast<const Taxonomy1&>(rhs);
-	return basePerm == other.basePerm;
-}
-
-
-std::size_t Taxonomy1::hash() const {
-	std::size_t seed = 0;
-	boost::hash_combine(seed, getGroup());
-	boost::hash_combine(seed, getBasePerm());
-	return seed;
+	
+	// Two Taxonomy1 instances over the same group are equal if they are generated by the same element
+	std::vector<boost::uint64_t> images(basePerm.size());
+	for (std::size_t i = 0; i < images.size(); i++) {
+		images[i] = basePerm.at(i);
+	}
+	intern(images);
 }
 
 Taxonomy1::Evaluator Taxonomy1::createEvaluator() const {
-	return Evaluator(pOrbit);
+	return Evaluator(pOrbit, unpackedOrbit, blocksPerPartition);
 }
 
 unsigned long Taxonomy1::evaluate(const Subset& B) const {
@@ -138,8 +228,37 @@ unsigned long Taxonomy1::evaluate(const Subset& B) const {
 	return table.query(B);
 }
 
+BoundGInvariant::ptr Taxonomy1::bind(Subset::size_type size) const {
+	return bindLookupTable(Taxonomy1EvalCache::getInstance().query(*this), size);
+}
+
 bool Taxonomy1::hasCachedResult(const Subset& B) const {
 	Taxonomy1LookupTable& cache = Taxonomy1EvalCache::getInstance().query(*this);
 	Taxonomy1LookupTable::Subtable& table = cache.query(B.size());
 	return table.contains(B);
-}
\ No newline at end of file
+}
+
+std::size_t Taxonomy1::cacheMemoryUsage() const {
+	Taxonomy1EvalCache& evalCache = Taxonomy1EvalCache::getInstance();
+	if (!evalCache.contains(*this)) return 0;
+	
+	// The evaluators only refer to the orbit, which belongs to the function rather than to its cache
+	return evalCache.query(*this).memoryUsage();
+}
+
+void Taxonomy1::dropCachedResults() const {
+	Taxonomy1EvalCache::getInstance().erase(*this);
+}
+
+boost::function<void ()> Taxonomy1::cacheDropper() const {
+	return boost::bind(&Taxonomy1EvalCache::eraseId, &Taxonomy1EvalCache::getInstance(), getId());
+}
+
+void Taxonomy1::retireCachedResults(Subset::size_type size) const {
+	Taxonomy1EvalCache& evalCache = Taxonomy1EvalCache::getInstance();
+	if (!evalCache.contains(*this)) return;
+	Taxonomy1LookupTable& cache = evalCache.query(*this);
+	for (Subset::size_type s = 0; s < size; s++) {
+		cache.erase(s);
+	}
+}
@@ -5,8 +5,6 @@
 
 class Taxonomy1Evaluator;
 
-typedef std::set<Subset> Partition;
-
 /**
  * Taxonomy 1, as defined by Magliveras-Leavitt.
  *
@@ -22,6 +20,8 @@ typedef std::set<Subset> Partition;
  * The input subset is transformed into a frequency vector for each partition in the orbit exactly
  * as in anchor set evaluation, and the resulting frequency vectors are then accumulated in a
  * "frequency vector of frequency vectors" to produce the result.
+ *
+ * The orbit is stored as packed blocks (see PackedSubset) if v <= MAX_PACKED_POINTS, and as Subsets otherwise.
  */
 class Taxonomy1 : public GInvariant {
 	typedef std::vector<Subset::size_type> FrequencyVector;
@@ -34,18 +34,30 @@ public:
 	
 	const Permutation& getBasePerm() const { return basePerm; }
 	
+	/**
+	 * Returns the number of blocks, over every partition in the orbit, that each evaluation intersects with the subset.
+	 */
+	std::size_t numOrbitBlocks() const { return pOrbit.empty() ? unpackedOrbit.size() : pOrbit.size(); }
+	
 	bool operator==(const Taxonomy1& rhs) const { return equals(rhs); }
 	bool operator!=(const Taxonomy1& rhs) const { return !equals(rhs); }
-	bool equals(const GInvariant& rhs) const;
-	std::size_t hash() const;
 	Evaluator createEvaluator() const;
 	
 	unsigned long evaluate(const Subset& B) const;
+	BoundGInvariant::ptr bind(Subset::size_type size) const;
 	bool hasCachedResult(const Subset& B) const;
+	std::size_t cacheMemoryUsage() const;
+	void dropCachedResults() const;
+	boost::function<void ()> cacheDropper() const;
+	void retireCachedResults(Subset::size_type size) const;
 private:
 	Permutation basePerm;
 	
-	std::set<Partition> pOrbit;
+	// The orbit of the partition, with each partition stored as blocksPerPartition consecutive blocks.  Only one of the
+	// two is filled, depending on whether v <= MAX_PACKED_POINTS.
+	std::vector<PackedSubset> pOrbit;
+	std::vector<Subset> unpackedOrbit;
+	std::size_t blocksPerPartition;
 };
 
 /**
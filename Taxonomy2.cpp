@@ -1,7 +1,12 @@
+#include <algorithm>
+
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/functional/hash.hpp>
 
+#include "CacheRegistry.h"
 #include "LookupTable.h"
 #include "Taxonomy2.h"
 
@@ -12,41 +17,121 @@
  * In essence, this is the "core" of the Taxonomy 2 method.
  */
 class Taxonomy2Evaluator {
-	const boost::shared_ptr<const Discriminator> phi;
+	boost::shared_ptr<DiscriminatorEvalCacheEntry> phiCache;		// Shared, so that the lookup table keeps it alive
 public:
-	// We use this as a sparse vector stand-in
-	typedef std::map<unsigned long, size_t> FrequencyVector;
+	// The multiset of discriminator outputs, as a sorted vector
+	typedef std::vector<unsigned long> FrequencyVector;
+	
+	explicit Taxonomy2Evaluator(const boost::shared_ptr<DiscriminatorEvalCacheEntry>& _phiCache) : phiCache(_phiCache) {}
 	
-	Taxonomy2Evaluator(const boost::shared_ptr<const Discriminator>& _phi) : phi(_phi) {}
+	bool isPacked() const { return phiCache->isPacked(); }
+	
+	FrequencyVector operator()(PackedSubset B) const {
+		// Each (k-1)-subset of B is B less one of its bits, so they can all be looked up in one batch
+		FrequencyVector result(popcount(B));
+		PackedSubset subsets[MAX_PACKED_POINTS];
+		std::size_t n = 0;
+		for (PackedSubset remaining = B; remaining != 0; remaining &= remaining - 1) {
+			subsets[n++] = B & ~(remaining & -remaining);
+		}
+		if (n != 0) phiCache->evaluateBatch(subsets, n, &result[0]);
+		
+		std::sort(result.begin(), result.end());
+		return result;
+	}
 	
 	FrequencyVector operator()(const Subset& B) const {
-		FrequencyVector result;	// indices range from 0 to fn->numOutputs() - 1, so it's likely this is sparse
+		if (isPacked()) return (*this)(packSubset(B));
+		
+		FrequencyVector result(B.size());
+		FrequencyVector::iterator out = result.begin();
 		for (Subset::const_iterator it = B.begin(); it != B.end(); ++it) {
 			Subset T(B.begin(), B.end());			// T = B ...
 			T.erase(T.find(*it));					// ... - {*it}
 			
-			// Evaluate discriminaotr on subset and tally
-			result[phi->evaluate(T)]++;
+			// Evaluate discriminator on subset and tally
+			*out++ = phiCache->evaluate(T);
 		}
 		
+		std::sort(result.begin(), result.end());
 		return result;
 	}
 };
 
 /* **************************************************************************************************** */
 /**
- * Table that caches the results of previous Taxonomy2 evaluation calls.
+ * Table that caches the results of previous Taxonomy2 evaluation calls.  It is keyed by packed subsets if the results of
+ * the Discriminator are.
  */
-class Taxonomy2LookupTable : public LookupTable<Taxonomy2Evaluator>::type {
-	typedef LookupTable<Taxonomy2Evaluator>::type super_type;
-	typedef EvaluationDelegate<Taxonomy2Evaluator> delegate_type;
+class Taxonomy2LookupTable : public SubsetLookupTable<Taxonomy2Evaluator> {
+	typedef SubsetLookupTable<Taxonomy2Evaluator> super_type;
 public:
 	Taxonomy2LookupTable(const Taxonomy2& fn) : super_type(delegate_type(fn.createEvaluator())) {}
 };
 
 /* **************************************************************************************************** */
-class Taxonomy2EvalCache : public boost::noncopyable, public HeapValueBoostUnorderedMapCache<Taxonomy2, Taxonomy2LookupTable, HeapValueFromKeyInsertDelegate<Taxonomy2LookupTable> >::type {
-	Taxonomy2EvalCache() {}
+/**
+ * Bound Taxonomy2.  Batches are evaluated a block of MATRIXGENERATOR_TAXONOMY2_BATCH_BLOCK subsets at a time: the subsets
+ * in the block that already have results are read from the lookup table, and every sub-subset of the rest is gathered
+ * into one batch for the Discriminator, so that its lookups overlap.
+ */
+class Taxonomy2Binding : public LookupTableBinding<Taxonomy2LookupTable> {
+	DiscriminatorEvalCacheEntry* phiCache;
+public:
+	Taxonomy2Binding(Taxonomy2LookupTable& table_, DiscriminatorEvalCacheEntry& phiCache_) :
+		LookupTableBinding<Taxonomy2LookupTable>(table_), phiCache(&phiCache_) {}
+	
+	void evaluateBatch(const PackedSubset* subsets, std::size_t n, unsigned long* results) const {
+		if (!table->isPacked()) {
+			BoundGInvariant::evaluateBatch(subsets, n, results);
+			return;
+		}
+		for (std::size_t first = 0; first < n; first += MATRIXGENERATOR_TAXONOMY2_BATCH_BLOCK) {
+			evaluateBlock(subsets + first, std::min<std::size_t>(MATRIXGENERATOR_TAXONOMY2_BATCH_BLOCK, n - first), results + first);
+		}
+	}
+private:
+	void evaluateBlock(const PackedSubset* subsets, std::size_t n, unsigned long* results) const {
+		PackedSubset missing[MATRIXGENERATOR_TAXONOMY2_BATCH_BLOCK];
+		std::size_t missingIdx[MATRIXGENERATOR_TAXONOMY2_BATCH_BLOCK];
+		std::size_t numMissing = 0;
+		for (std::size_t i = 0; i < n; i++) {
+			const unsigned long* cached = table->find(subsets[i]);
+			if (cached) {
+				results[i] = *cached;
+			} else {
+				missing[numMissing] = subsets[i];
+				missingIdx[numMissing++] = i;
+			}
+		}
+		if (numMissing == 0) return;
+		
+		// Each subset B is followed by the |B| subsets of B less one point, as in Taxonomy2Evaluator
+		std::size_t size = popcount(missing[0]);
+		std::vector<PackedSubset> gathered(numMissing * size);
+		std::vector<unsigned long> outputs(gathered.size());
+		std::vector<PackedSubset>::iterator out = gathered.begin();
+		for (std::size_t j = 0; j < numMissing; j++) {
+			for (PackedSubset remaining = missing[j]; remaining != 0; remaining &= remaining - 1) {
+				*out++ = missing[j] & ~(remaining & -remaining);
+			}
+		}
+		if (!gathered.empty()) phiCache->evaluateBatch(&gathered[0], gathered.size(), &outputs[0]);
+		
+		// Translate under the write lock of the lookup table, as if the subsets had been queried one at a time
+		Taxonomy2LookupTable::translator_type& translator = table->getTranslator();
+		for (std::size_t j = 0; j < numMissing; j++) {
+			Taxonomy2Evaluator::FrequencyVector fv(outputs.begin() + j * size, outputs.begin() + (j + 1) * size);
+			std::sort(fv.begin(), fv.end());
+			PrecomputedTranslation<Taxonomy2LookupTable::translator_type> translate(translator, fv);
+			results[missingIdx[j]] = table->query(missing[j], translate);
+		}
+	}
+};
+
+/* **************************************************************************************************** */
+class Taxonomy2EvalCache : public boost::noncopyable, public IdKeyedCache<Taxonomy2, Taxonomy2LookupTable> {
+	Taxonomy2EvalCache() { CacheRegistry::getInstance().add("Taxonomy2EvalCache", *this); }
 public:
 	static Taxonomy2EvalCache& getInstance() {
 		static Taxonomy2EvalCache instance;
@@ -55,28 +140,8 @@ public:
 };
 
 /* **************************************************************************************************** */
-/**
- * Tests two Taxonomy2 for equality.
- *
- * Two Taxonomy2 over the same group are equal if and only if their two Discriminators are equal.
- */
-bool Taxonomy2::equals(const GInvariant& rhs) const {
-	if (!GInvariant::equals(rhs)) return false;
-	const Taxonomy2& other = static_cast<const Taxonomy2&>(rhs);
-	
-	return *phi == *(other.phi);
-}
-
-
-std::size_t Taxonomy2::hash() const {
-	std::size_t seed = 0;
-	boost::hash_combine(seed, getGroup());
-	boost::hash_combine(seed, *phi);		// Hash the discriminator, not the pointer
-	return seed;
-}
-
 Taxonomy2::Evaluator Taxonomy2::createEvaluator() const {
-	return Evaluator(phi);
+	return Evaluator(phiCache);
 }
 
 /**
@@ -90,6 +155,14 @@ unsigned long Taxonomy2::evaluate(const Subset& B) const {
 	return table.query(B);
 }
 
+/**
+ * Taxonomy2 only works on one size of subsets, so the size is not needed to find its lookup table.
+ */
+BoundGInvariant::ptr Taxonomy2::bind(Subset::size_type) const {
+	Taxonomy2LookupTable& table = Taxonomy2EvalCache::getInstance().query(*this);
+	return BoundGInvariant::ptr(new Taxonomy2Binding(table, *phiCache));
+}
+
 bool Taxonomy2::hasCachedResult(const Subset& B) const {
 	Taxonomy2LookupTable& table = Taxonomy2EvalCache::getInstance().query(*this);
 	
@@ -106,8 +179,29 @@ std::deque<GInvariantEvaluationTask> Taxonomy2::getDependents(const Subset& B) c
 		T.erase(T.find(*it));
 		
 		// Only insert uncached results
-		if (!phi->hasCachedResult(T)) results.push_back(GInvariantEvaluationTask(boost::const_pointer_cast<Discriminator>(phi), T));
+		if (!phiCache->hasCachedResult(T)) results.push_back(GInvariantEvaluationTask(boost::const_pointer_cast<Discriminator>(phi), T));
 	}
 	
 	return results;
-}
\ No newline at end of file
+}
+
+std::size_t Taxonomy2::cacheMemoryUsage() const {
+	Taxonomy2EvalCache& evalCache = Taxonomy2EvalCache::getInstance();
+	if (!evalCache.contains(*this)) return 0;
+	return evalCache.query(*this).memoryUsage();
+}
+
+void Taxonomy2::dropCachedResults() const {
+	Taxonomy2EvalCache::getInstance().erase(*this);
+}
+
+boost::function<void ()> Taxonomy2::cacheDropper() const {
+	return boost::bind(&Taxonomy2EvalCache::eraseId, &Taxonomy2EvalCache::getInstance(), getId());
+}
+
+/**
+ * Taxonomy2 only works on subsets one larger than those of its discriminator, so its cache is retired as a whole.
+ */
+void Taxonomy2::retireCachedResults(Subset::size_type size) const {
+	if (phi->getSubsetSize() + 1 < size) dropCachedResults();
+}
@@ -4,13 +4,21 @@
 #ifndef TAXONOMY2_H
 #define TAXONOMY2_H
 
+/* The number of subsets that a bound Taxonomy2 evaluates together, gathering the lookups of their sub-subsets in the
+ * Discriminator into one batch (see BoundGInvariant::evaluateBatch()).
+ */
+#ifndef MATRIXGENERATOR_TAXONOMY2_BATCH_BLOCK
+#define MATRIXGENERATOR_TAXONOMY2_BATCH_BLOCK 16
+#endif
+
 class Taxonomy2Evaluator;
 
 // Taxonomy2 is centrally managed by DiscriminatorEvalCache (specifically, a DiscriminatorEvalCacheEntry), an internal
-// supporting class for Discriminator.  DiscriminatorEvalCache also keeps a reference to the associated Discriminator,
-// so there are no retain cycles.
+// supporting class for Discriminator.  The Taxonomy2 holds on to the entry, and the entry only keeps a weak reference
+// back, so there are no retain cycles.
 //
-// The side benefit is that Taxonomy2 will not have to use DiscriminatorEvalCache for its own translation tables.
+// The side benefit is that Taxonomy2 will not have to use DiscriminatorEvalCache for its own translation tables, and
+// that it can evaluate the Discriminator through its entry directly, even once the entry is retired.
 class DiscriminatorEvalCacheEntry;
 
 /**
@@ -35,18 +43,23 @@ public:
 	
 	bool operator==(const Taxonomy2& rhs) const { return equals(rhs); }
 	bool operator!=(const Taxonomy2& rhs) const { return !equals(rhs); }
-	bool equals(const GInvariant& rhs) const;
-	std::size_t hash() const;
 	Evaluator createEvaluator() const;
 	
 	unsigned long evaluate(const Subset& B) const;
+	BoundGInvariant::ptr bind(Subset::size_type size) const;
 	bool hasCachedResult(const Subset& B) const;
 	std::deque<GInvariantEvaluationTask> getDependents(const Subset& B) const;
+	std::size_t cacheMemoryUsage() const;
+	void dropCachedResults() const;
+	boost::function<void ()> cacheDropper() const;
+	void retireCachedResults(Subset::size_type size) const;
 private:
-	Taxonomy2(const Group& _G, const boost::shared_ptr<const Discriminator>& _phi) :
-		GInvariant(_G), phi(_phi) {}
+	// Two Taxonomy2 over the same group are equal if and only if their two Discriminators are equal
+	Taxonomy2(const Group& _G, const boost::shared_ptr<const Discriminator>& _phi, const boost::shared_ptr<DiscriminatorEvalCacheEntry>& _phiCache) :
+		GInvariant(_G), phi(_phi), phiCache(_phiCache) { intern(std::vector<boost::uint64_t>(1, phi->getId())); }
 	
 	boost::shared_ptr<const Discriminator> phi;
+	boost::shared_ptr<DiscriminatorEvalCacheEntry> phiCache;		// The entry that created this, which holds the results of phi
 };
 
 /* ********************************************************************************************************************* */
@@ -9,12 +9,9 @@
  * overhead of evaluation caches and stuff.
  */
 struct TrivialDiscriminator : public GInvariant {
-	TrivialDiscriminator(const Group& G) : GInvariant(G) {}
+	TrivialDiscriminator(const Group& G) : GInvariant(G) { intern(std::vector<boost::uint64_t>()); }
 	virtual ~TrivialDiscriminator() {}
 	
-	bool equals(const GInvariant& rhs) const;
-	std::size_t hash() const;
-	
 	/**
 	 * Evaluates this G-invariant function on the input subset.  As a trivial discriminator, this just returns a
 	 * constant value.
@@ -1,12 +1,17 @@
+#include <cstdlib>
+#include <fstream>
 #include <iostream>
 #include <list>
+#include <string>
 
 #include <boost/array.hpp>
 #include <boost/make_shared.hpp>
 
+#include "Benchmark.h"
 #include "Group.h"
 #include "Groups.h"
 #include "KMCompute.h"
+#include "LevelMetrics.h"
 #include "CPlexSolver.h"
 
 typedef std::vector<int> SolutionVector;
@@ -49,6 +54,24 @@ Matrix genSampleMatrix() {
 }
 
 int main (int argc, char * const argv[]) {
+	// "--metrics file" appends the metrics of each level to file, one line of JSON per level; without it none are written
+	std::ofstream metrics;
+	if (argc > 2 && std::string(argv[1]) == "--metrics") {
+		metrics.open(argv[2], std::ios_base::out | std::ios_base::app);
+		if (!metrics) {
+			std::cerr << "Could not open " << argv[2] << std::endl;
+			return 1;
+		}
+		LevelMetrics::setStream(metrics);
+		argc -= 2;
+		argv += 2;
+	}
+	
+	if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+		// Optionally followed by the minimum number of seconds to spend on each benchmark
+		return runBenchmarks(std::cout, (argc > 2) ? std::atof(argv[2]) : 1.0);
+	}
+	
 	std::cout << "Starting" << std::endl;
 	KramerMesnerMatrix A = createKMMatrix();
 	std::cout << "Done" << std::endl;
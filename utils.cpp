@@ -1,5 +1,7 @@
+#include "Cache.h"
 #include "utils.h"
 
+#include <boost/noncopyable.hpp>
 #include <boost/iterator/counting_iterator.hpp>
 
 // Slightly pollute permlib namespace for this...
@@ -52,21 +54,21 @@ Subset xMinus(unsigned int v, const Subset& B) {
  */
 std::vector<Cycle> permutationCycles(const Permutation& g, int v) {
 	// Permutation stores {1, .., v} as {0, .., v - 1}
-	Subset pointsRemaining = generateX(v);
+	std::vector<boost::uint64_t> visited(cycleBitmaskWords(v));
 	
 	std::vector<Cycle> cycles;
-	while (!pointsRemaining.empty()) {
-		Cycle cycle;
+	for (int firstPoint = 0; firstPoint < v; firstPoint++) {
+		if (visited[firstPoint / 64] & (boost::uint64_t(1) << (firstPoint % 64))) continue;
 		
-		unsigned long firstPoint = *(pointsRemaining.begin());
+		Cycle cycle;
 		unsigned long nextPoint = firstPoint;
 		do {
 			cycle.push_back(nextPoint);
-			pointsRemaining.erase(pointsRemaining.find(nextPoint));
+			visited[nextPoint / 64] |= boost::uint64_t(1) << (nextPoint % 64);
 			
 			// Next point in cycle
 			nextPoint = g.at(nextPoint);
-		} while (nextPoint != firstPoint);
+		} while (nextPoint != static_cast<unsigned long>(firstPoint));
 		
 		cycles.push_back(cycle);
 	}
@@ -75,59 +77,139 @@ std::vector<Cycle> permutationCycles(const Permutation& g, int v) {
 }
 
 /**
- * Partitions the input integer k.
+ * Computes the cycle type of a permutation, without allocating any memory.  On return, counts[i] is the number of
+ * cycles of length i + 1; cycles longer than maxLength are not counted.
  *
- * This particular implementation is particularly inefficient for large values of k (as the list
- * of partitions grows large), so it should be replaced with one based on a forward iterator.
- * In practice, the inputs will tend to be on the small size...
+ * @param counts Receives the cycle type.  Must have room for maxLength entries.
+ * @param visited Scratch space for the visited bitmask.  Must have room for cycleBitmaskWords(v) words; its contents
+ *                on entry are ignored.
  */
-std::set<std::multiset<unsigned int> > partition(unsigned int k) {
-	if (k == 1) {
-		std::multiset<unsigned int> singleton;
-		singleton.insert(1);
+void permutationCycleType(const Permutation& g, unsigned int v, unsigned int maxLength, unsigned int* counts, boost::uint64_t* visited) {
+	std::fill(visited, visited + cycleBitmaskWords(v), 0);
+	std::fill(counts, counts + maxLength, 0);
+	
+	for (unsigned long firstPoint = 0; firstPoint < v; firstPoint++) {
+		if (visited[firstPoint / 64] & (boost::uint64_t(1) << (firstPoint % 64))) continue;
 		
-		std::set<std::multiset<unsigned int> > result;
-		result.insert(singleton);
-		return result;
-	} else {
-		std::set<std::multiset<unsigned int> > result;
-		for (int i = 1; i < k; i++) {
-			// Partition k - i and append i to each result therein
-			std::set<std::multiset<unsigned int> > smaller = partition(k - i);
-			
-			for (std::set<std::multiset<unsigned int> >::iterator it = smaller.begin(); it != smaller.end(); it++) {
-				std::multiset<unsigned int> ms(*it);	// Copy the multiset
-				ms.insert(i);
-				result.insert(ms);
-			}
+		unsigned int length = 0;
+		unsigned long nextPoint = firstPoint;
+		do {
+			visited[nextPoint / 64] |= boost::uint64_t(1) << (nextPoint % 64);
+			length++;
+			nextPoint = g.at(nextPoint);
+		} while (nextPoint != firstPoint);
+		
+		if (length <= maxLength) counts[length - 1]++;
+	}
+}
+
+/**
+ * Enumerates the partitions of k.  The partitions are generated iteratively in reverse lexicographic order (from {k}
+ * down to {1, .., 1}), each one being written out as a tally vector as soon as it is generated.
+ */
+PartitionTable::PartitionTable(unsigned int k_) : k(k_), numPartitions(0), tallies() {
+	if (k == 0) {
+		numPartitions = 1;		// The empty partition, whose tally vector is empty
+		return;
+	}
+	
+	std::vector<unsigned int> parts(k);		// The current partition, with its parts in non-increasing order
+	std::size_t length = 1;
+	parts[0] = k;
+	
+	while (true) {
+		tallies.resize(tallies.size() + k);
+		unsigned int* tally = &tallies[numPartitions * k];
+		for (std::size_t i = 0; i < length; i++) {
+			tally[parts[i] - 1]++;
 		}
+		numPartitions++;
 		
-		// Finally, add the singleton k itself
-		std::multiset<unsigned int> singleton;
-		singleton.insert(k);
-		result.insert(singleton);
+		// Find the last part that is greater than 1; if there is none, we are at {1, .., 1}
+		std::size_t i = length;
+		while (i > 0 && parts[i - 1] == 1) i--;
+		if (i == 0) break;
+		i--;
 		
-		return result;
+		// Decrement that part, and redistribute the 1s after it (plus the one just taken) in parts no larger than it
+		unsigned int remainder = static_cast<unsigned int>(length - i);
+		unsigned int part = --parts[i];
+		length = i + 1;
+		while (remainder > part) {
+			parts[length++] = part;
+			remainder -= part;
+		}
+		parts[length++] = remainder;
 	}
 }
 
+/**
+ * Cache for the partition tables, so that each k is only ever enumerated once.
+ *
+ * This is implemented as a "classic singleton", so is guaranteed thread-safe under C++11, but under C++03
+ * this is limited to single-threaded operation.  It should be thread-safe under C++03 on gcc and clang, the
+ * two compilers used in development.
+ */
+class PartitionTableCache : public boost::noncopyable, public HeapValueStdMapCache<unsigned int, PartitionTable, HeapValueFromKeyInsertDelegate<PartitionTable> >::type {
+public:
+	static PartitionTableCache& getInstance() {
+		static PartitionTableCache instance;
+		return instance;
+	}
+	
+private:
+	PartitionTableCache() {}
+};
+
+/**
+ * Returns the partitions of k.  The table is computed on first use, and the same table is returned thereafter.
+ */
+const PartitionTable& partitionTable(unsigned int k) {
+	return PartitionTableCache::getInstance().query(k);
+}
+
 /**
  * Computes the binomial coefficient.
  *
  * Note that we avoid boost::math::binomial_coefficient() because it's not recommended for
  * integer return types (it uses factorials and beta function).
+ *
+ * @throws std::overflow_error if the result does not fit in 64 bits.
  */
-unsigned int combinat(unsigned int n, unsigned int k) {
+boost::uint64_t combinat(unsigned int n, unsigned int k) {
+	if (k > n) return 0;
 	if (k > n - k) k = n - k;		// Symmetry of the binomial coefficient
-	int result = 1;
-	for (int i = 0; i < k; i++) {
-		result *= n - i;
-		result /= i + 1;			// Avoids fractions
+	boost::uint64_t result = 1;
+	for (unsigned int i = 0; i < k; i++) {
+		// result * (n - i) is divisible by i + 1, but may overflow before the division, so split result by i + 1 first
+		boost::uint64_t d = i + 1;
+		result = checkedAdd(checkedMultiply(result / d, n - i), (result % d) * (n - i) / d);
 	}
 	
 	return result;
 }
 
+const boost::uint64_t BinomialTable::OVERFLOWED;
+
+/**
+ * Builds Pascal's triangle up to row n.
+ */
+BinomialTable::BinomialTable(unsigned int n_) : n(n_), entries((n_ + 1) * (n_ + 2) / 2) {
+	for (unsigned int m = 0; m <= n; m++) {
+		boost::uint64_t* row = &entries[m * (m + 1) / 2];
+		const boost::uint64_t* previous = row - m;		// Row m - 1, if m > 0
+		row[0] = row[m] = 1;
+		for (unsigned int k = 1; k < m; k++) {
+			// Once an entry overflows, every entry below it does as well
+			if (previous[k - 1] == OVERFLOWED || previous[k] == OVERFLOWED || previous[k - 1] > OVERFLOWED - 1 - previous[k]) {
+				row[k] = OVERFLOWED;
+			} else {
+				row[k] = previous[k - 1] + previous[k];
+			}
+		}
+	}
+}
+
 bool PermutationWeakOrdering::operator()(const Permutation& perm1, const Permutation& perm2) const {
 	int pos = 0;
 	for (; pos < perm1.size(); pos++) {
@@ -1,9 +1,13 @@
 #include <algorithm>
 #include <iterator>
+#include <limits>
 #include <set>
+#include <stdexcept>
 #include <vector>
 
+#include <boost/cstdint.hpp>
 #include <boost/functional/hash.hpp>
+#include <boost/throw_exception.hpp>
 #include <permlib/permutation.h>
 #include <permlib/bsgs.h>
 #include <permlib/transversal/schreier_tree_transversal.h>
@@ -41,8 +45,215 @@ namespace permlib {
 }
 
 std::vector<Cycle> permutationCycles(const Permutation& g, int v);
-std::set<std::multiset<unsigned int> > partition(unsigned int k);
-unsigned int combinat(unsigned int n, unsigned int k);
+void permutationCycleType(const Permutation& g, unsigned int v, unsigned int maxLength, unsigned int* counts, boost::uint64_t* visited);
+
+/**
+ * The number of 64-bit words needed by the visited bitmask of permutationCycleType().
+ */
+inline std::size_t cycleBitmaskWords(unsigned int v) { return (v + 63) / 64; }
+boost::uint64_t combinat(unsigned int n, unsigned int k);
+
+/**
+ * Adds two unsigned 64-bit integers, throwing std::overflow_error if the result does not fit.
+ */
+inline boost::uint64_t checkedAdd(boost::uint64_t a, boost::uint64_t b) {
+	if (a > std::numeric_limits<boost::uint64_t>::max() - b) boost::throw_exception(std::overflow_error("64-bit addition overflow"));
+	return a + b;
+}
+
+/**
+ * Multiplies two unsigned 64-bit integers, throwing std::overflow_error if the result does not fit.
+ */
+inline boost::uint64_t checkedMultiply(boost::uint64_t a, boost::uint64_t b) {
+	if (b != 0 && a > std::numeric_limits<boost::uint64_t>::max() / b) boost::throw_exception(std::overflow_error("64-bit multiplication overflow"));
+	return a * b;
+}
+
+/**
+ * Pascal's triangle up to row n, with 64-bit entries.  Entries too large for 64 bits are stored as such, and only
+ * cause an error if they are actually looked up.
+ */
+class BinomialTable {
+public:
+	explicit BinomialTable(unsigned int n);
+	
+	unsigned int getN() const { return n; }
+	
+	/**
+	 * Returns the binomial coefficient (m choose k), which is 0 if k > m.
+	 *
+	 * Precondition: m <= getN()
+	 * @throws std::overflow_error if (m choose k) does not fit in 64 bits.
+	 */
+	boost::uint64_t operator()(unsigned int m, unsigned int k) const {
+		if (k > m) return 0;
+		boost::uint64_t value = entries[m * (m + 1) / 2 + k];
+		if (value == OVERFLOWED) boost::throw_exception(std::overflow_error("Binomial coefficient does not fit in 64 bits"));
+		return value;
+	}
+private:
+	static const boost::uint64_t OVERFLOWED = ~boost::uint64_t(0);
+	
+	unsigned int n;
+	std::vector<boost::uint64_t> entries;		// Row m starts at index m * (m + 1) / 2
+};
+
+/**
+ * The partitions of an integer k, stored as tally vectors in one flat array.  The tally vector of a partition gives, for
+ * each part size 1, .., k, the number of times that part appears in the partition.
+ */
+class PartitionTable {
+public:
+	explicit PartitionTable(unsigned int k);
+	
+	unsigned int getK() const { return k; }
+	std::size_t size() const { return numPartitions; }
+	
+	/**
+	 * Returns the tally vector of the i-th partition; tally(i)[j] is the multiplicity of the part j + 1.  The only
+	 * partition of 0 is empty, so for k == 0 this returns a null pointer.
+	 */
+	const unsigned int* tally(std::size_t i) const { return tallies.empty() ? 0 : &tallies[i * k]; }
+private:
+	unsigned int k;
+	std::size_t numPartitions;
+	std::vector<unsigned int> tallies;		// numPartitions blocks of k entries each
+};
+
+const PartitionTable& partitionTable(unsigned int k);
+
+/* PACKED SUBSETS ****************************************************** */
+// For v <= 64, a subset of X = {0, .., v - 1} can be packed into a single 64-bit word, where point i is bit i.  The hot
+// loops of the GInvariant evaluators work on packed subsets, where intersection is a single AND and size is a popcount.
+
+typedef boost::uint64_t PackedSubset;
+
+const unsigned int MAX_PACKED_POINTS = 64;
+
+/**
+ * Returns the number of points in a packed subset.
+ */
+inline unsigned int popcount(PackedSubset B) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_popcountll(B);
+#else
+	B = B - ((B >> 1) & 0x5555555555555555ULL);
+	B = (B & 0x3333333333333333ULL) + ((B >> 2) & 0x3333333333333333ULL);
+	B = (B + (B >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return static_cast<unsigned int>((B * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+/**
+ * Returns the least point in a packed subset.
+ *
+ * Precondition: B != 0
+ */
+inline unsigned int lowestPoint(PackedSubset B) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(B);
+#else
+	unsigned int i = 0;
+	while (!(B & 1)) {
+		B >>= 1;
+		i++;
+	}
+	return i;
+#endif
+}
+
+/**
+ * Packs a subset into a single word.
+ *
+ * @throws std::out_of_range if B contains a point that is at least MAX_PACKED_POINTS.
+ */
+inline PackedSubset packSubset(const Subset& B) {
+	PackedSubset result = 0;
+	for (Subset::const_iterator it = B.begin(); it != B.end(); ++it) {
+		if (*it >= MAX_PACKED_POINTS) boost::throw_exception(std::out_of_range("Subset point does not fit in a PackedSubset"));
+		result |= PackedSubset(1) << *it;
+	}
+	return result;
+}
+
+/**
+ * Unpacks a packed subset.
+ */
+inline Subset unpackSubset(PackedSubset B) {
+	Subset result;
+	for (; B != 0; B &= B - 1) {
+		result.insert(result.end(), lowestPoint(B));
+	}
+	return result;
+}
+
+/**
+ * Returns the image of a packed subset under a permutation.
+ */
+inline PackedSubset applyPermutation(const Permutation& g, PackedSubset B) {
+	PackedSubset result = 0;
+	for (; B != 0; B &= B - 1) {
+		result |= PackedSubset(1) << g.at(lowestPoint(B));
+	}
+	return result;
+}
+
+/**
+ * Hash function for packed subsets (and other 64-bit keys), using the SplitMix64 finalizer.  Unlike boost::hash, all of
+ * the bits of the input affect the low bits of the result, so the result can be used as-is by power-of-two tables.
+ */
+inline boost::uint64_t hashPacked(boost::uint64_t x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	x ^= x >> 31;
+	return x;
+}
+
+/**
+ * Hash functor for packed subsets, for use as the hash of unordered containers keyed by them.
+ */
+struct PackedSubsetHash {
+	std::size_t operator()(PackedSubset B) const { return std::size_t(hashPacked(B)); }
+};
+
+/**
+ * A counter-based random number generator: the nth number drawn is hashPacked() of the key plus n times a fixed odd
+ * increment (the SplitMix64 sequence).  A generator has no state besides its counter, so each thread can draw from its
+ * own, and a sequence can be replayed exactly from its key alone, on any platform and boost version.
+ */
+class SplitMix64 {
+public:
+	typedef boost::uint64_t result_type;
+	
+	explicit SplitMix64(boost::uint64_t key) : state(key) {}
+	
+	/**
+	 * Keys an independent sequence by a seed and two stream indices, such as a level and an attempt at that level.
+	 */
+	SplitMix64(boost::uint64_t seed, boost::uint64_t stream, boost::uint64_t substream) :
+		state(hashPacked(hashPacked(hashPacked(seed) ^ stream) ^ substream)) {}
+	
+	result_type operator()() {
+		state += 0x9e3779b97f4a7c15ULL;
+		return hashPacked(state);
+	}
+	
+	/**
+	 * Draws uniformly from {0, .., bound - 1}, rejecting the draws that would bias the result towards small values.
+	 */
+	boost::uint64_t below(boost::uint64_t bound) {
+		boost::uint64_t limit = std::numeric_limits<boost::uint64_t>::max() - std::numeric_limits<boost::uint64_t>::max() % bound;
+		boost::uint64_t x;
+		do {
+			x = (*this)();
+		} while (x >= limit);
+		return x % bound;
+	}
+private:
+	boost::uint64_t state;
+};
 
 inline void printSubset(const Subset& B) {
 	for (Subset::const_iterator it = B.begin(); it != B.end(); it++) {